@@ -35,98 +35,144 @@
 #include "private.h"
 
 
-int 
-init_aifx(AIFF_Ref r)
+/*
+ * Check a sound format, wherever it comes from: the readers
+ * divide by the channel count and the sample size. Return 1
+ * if it can be used, 0 if not.
+ */
+int
+check_aifx_common(const AIFXFormat *f)
+{
+	if (f->nChannels < 1 || f->nChannels > 0xFFFF ||
+	    f->nSamples > 0xFFFFFFFFU ||
+	    f->bitsPerSample < 1 || f->bitsPerSample > 32)
+		return (0);
+	switch (f->audioFormat) {
+	case AUDIO_FORMAT_LPCM:
+	case AUDIO_FORMAT_UNKNOWN:
+		return (f->segmentSize == (f->bitsPerSample + 7) >> 3);
+	case AUDIO_FORMAT_ULAW:
+	case AUDIO_FORMAT_ALAW:
+		return (f->segmentSize == 2);
+	case AUDIO_FORMAT_FL32:
+		return (f->segmentSize == 4);
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Decode the first 'len' bytes (at least 18) of
+ * a COMM chunk of an AIFF or AIFF-C ('format') file.
+ * Return 1, or 0 if the format can not be used.
+ */
+int
+parse_aifx_common(const uint8_t *buf, uint32_t len, IFFType format, AIFXFormat *f)
 {
-	int bps, wSegmentSize;
-	double sRate;
-	uint8_t buffer[10];
-	uint32_t len;
 	CommonChunk p;
 	IFFType aFmt;
 
-	if (!find_iff_chunk(AIFF_COMM, r, &len))
-		return (-1);
-
-	if (len < 18)
-		return (-1);
-
-	if (fread(&(p.numChannels), 1, 2, r->fd) < 2 ||
-	    fread(&(p.numSampleFrames), 1, 4, r->fd) < 4 ||
-	    fread(&(p.sampleSize), 1, 2, r->fd) < 2 ||
-	    fread(buffer, 1, 10, r->fd) < 10)
-		return (-1);
+	memcpy(&(p.numChannels), buf, 2);
+	memcpy(&(p.numSampleFrames), buf + 2, 4);
+	memcpy(&(p.sampleSize), buf + 6, 2);
 
 	p.numChannels = ARRANGE_BE16(p.numChannels);
 	p.numSampleFrames = ARRANGE_BE32(p.numSampleFrames);
 	p.sampleSize = ARRANGE_BE16(p.sampleSize);
-	sRate = ieee754_read_extended(buffer);
-
-	r->nSamples = p.numSampleFrames;
-	r->nChannels = p.numChannels;
-	r->samplingRate = sRate;
-	r->bitsPerSample = p.sampleSize;
 
-	bps = p.sampleSize;
-	wSegmentSize = (bps + 7) >> 3;
-	r->segmentSize = wSegmentSize;
+	f->nSamples = p.numSampleFrames;
+	f->nChannels = p.numChannels;
+	f->samplingRate = ieee754_read_extended(buf + 8);
+	f->bitsPerSample = p.sampleSize;
+	f->segmentSize = (p.sampleSize + 7) >> 3;
+	f->flags = 0;
 
-	if (len >= 22 && r->format == AIFF_TYPE_AIFC) {
-		if (fread(&aFmt, 1, 4, r->fd) < 4)
-			return (-1);
+	if (len >= 22 && format == AIFF_TYPE_AIFC) {
+		memcpy(&aFmt, buf + 18, 4);
 		switch (aFmt) {
 		case AUDIO_FORMAT_LPCM:	/* 'NONE' */
 		case AUDIO_FORMAT_lpcm:	/* 'lpcm' (not standard) */
 		case AUDIO_FORMAT_twos:	/* 'twos' */
-			r->audioFormat = AUDIO_FORMAT_LPCM;
-			r->flags |= LPCM_BIG_ENDIAN;
+			f->audioFormat = AUDIO_FORMAT_LPCM;
+			f->flags |= LPCM_BIG_ENDIAN;
 			break;
 			
 		case AUDIO_FORMAT_ULAW: /* 'ULAW' */
 		case AUDIO_FORMAT_ulaw: /* 'ulaw' */
-			r->audioFormat = AUDIO_FORMAT_ULAW;
-			r->segmentSize = 2;
-			r->bitsPerSample = 14;
+			f->audioFormat = AUDIO_FORMAT_ULAW;
+			f->segmentSize = 2;
+			f->bitsPerSample = 14;
 			break;
 		
 		case AUDIO_FORMAT_ALAW: /* 'ALAW' */
 		case AUDIO_FORMAT_alaw: /* 'alaw' */
-			r->audioFormat = AUDIO_FORMAT_ALAW;
-			r->segmentSize = 2;
-			r->bitsPerSample = 13;
+			f->audioFormat = AUDIO_FORMAT_ALAW;
+			f->segmentSize = 2;
+			f->bitsPerSample = 13;
 			break;
 			
 		case AUDIO_FORMAT_sowt:	/* 'sowt' */
-			r->audioFormat = AUDIO_FORMAT_LPCM;
-			r->flags |= LPCM_LTE_ENDIAN;
+			f->audioFormat = AUDIO_FORMAT_LPCM;
+			f->flags |= LPCM_LTE_ENDIAN;
 			break;
 
 		case AUDIO_FORMAT_FL32: /* 'FL32' */
 		case AUDIO_FORMAT_fl32: /* 'fl32' */
-			r->audioFormat = AUDIO_FORMAT_FL32;
-			r->segmentSize = 4;
-			r->bitsPerSample = 32;
-			r->flags |= LPCM_BIG_ENDIAN;
+			f->audioFormat = AUDIO_FORMAT_FL32;
+			f->segmentSize = 4;
+			f->bitsPerSample = 32;
+			f->flags |= LPCM_BIG_ENDIAN;
 			break;
 				
 		default:
-			r->audioFormat = AUDIO_FORMAT_UNKNOWN;
+			f->audioFormat = AUDIO_FORMAT_UNKNOWN;
 		}
+	} else {
+		f->audioFormat = AUDIO_FORMAT_LPCM;
+		f->flags |= LPCM_BIG_ENDIAN;
+	}
 
-		/*
-		 * Read the description string if 
-		 * the F_NOTSEEKABLE flag is set
-		 */
-		if (len > 22 && (r->flags & F_NOTSEEKABLE)) {
-			int count = PASCALInGetLength(r->fd);
-			while (count-- > 0) {
-				if (getc(r->fd) < 0)
-					return (-1);
-			}
+	return (check_aifx_common(f));
+}
+
+int 
+init_aifx(AIFF_Ref r)
+{
+	uint8_t buffer[22];
+	uint32_t len, n;
+	AIFXFormat f;
+
+	if (!find_iff_chunk(AIFF_COMM, r, &len))
+		return (-1);
+
+	if (len < 18)
+		return (-1);
+
+	n = (len >= 22 && r->format == AIFF_TYPE_AIFC ? 22 : 18);
+	if (fread(buffer, 1, n, r->fd) < n)
+		return (-1);
+	if (!parse_aifx_common(buffer, len, r->format, &f))
+		return (-1);
+
+	r->nSamples = f.nSamples;
+	r->nChannels = f.nChannels;
+	r->samplingRate = f.samplingRate;
+	r->bitsPerSample = f.bitsPerSample;
+	r->segmentSize = f.segmentSize;
+	r->audioFormat = f.audioFormat;
+	r->flags |= f.flags;
+
+	/*
+	 * Read the description string if 
+	 * the F_NOTSEEKABLE flag is set
+	 */
+	if (len > 22 && r->format == AIFF_TYPE_AIFC &&
+	    (r->flags & F_NOTSEEKABLE)) {
+		int count = PASCALInGetLength(r->fd);
+		while (count-- > 0) {
+			if (getc(r->fd) < 0)
+				return (-1);
 		}
-	} else {
-		r->audioFormat = AUDIO_FORMAT_LPCM;
-		r->flags |= LPCM_BIG_ENDIAN;
 	}
 
 	return (1);
@@ -187,6 +233,308 @@ read_aifx_marker(AIFF_Ref r, int *id, uint64_t * position, char **name)
 	return (1);
 }
 
+static int
+marker_cmp(const void *a, const void *b)
+{
+	const AIFF_Marker *x = a;
+	const AIFF_Marker *y = b;
+
+	if (x->position != y->position)
+		return (x->position < y->position ? -1 : 1);
+	return ((int) x->id - (int) y->id);
+}
+
+/*
+ * Read the whole MARK chunk at once into a single block holding the
+ * list, the markers (sorted by position) and their names; the raw
+ * chunk is read into the tail of the same block.
+ * Return 1, 0 if there is no MARK chunk, or -1 on error.
+ */
+int 
+read_aifx_markers(AIFF_Ref r, AIFF_MarkerList **list)
+{
+	AIFF_MarkerList *l;
+	AIFF_Marker *m;
+	uint8_t *raw, *p, *end;
+	char *names;
+	uint32_t cklen, pos;
+	uint16_t n, id;
+	size_t max, step, i;
+	int c;
+
+	*list = NULL;
+	if (!find_iff_chunk(AIFF_MARK, r, &cklen))
+		return (0);
+	if (cklen < 2)
+		return (-1);
+
+	/*
+	 * A marker takes at least 7 bytes in the chunk and
+	 * its name takes no more memory than it does on file.
+	 */
+	max = (cklen - 2) / 7;
+	l = malloc(sizeof(AIFF_MarkerList) + max * sizeof(AIFF_Marker) +
+	    2 * (size_t) cklen);
+	if (l == NULL)
+		return (-1);
+	l->markers = (AIFF_Marker *) (l + 1);
+	names = (char *) (l->markers + max);
+	raw = (uint8_t *) names + cklen;
+	if (fread(raw, 1, cklen, r->fd) < cklen) {
+		free(l);
+		return (-1);
+	}
+
+	memcpy(&n, raw, 2);
+	n = ARRANGE_BE16(n);
+	p = raw + 2;
+	end = raw + cklen;
+	for (i = 0; i < n && i < max; i++) {
+		if (end - p < 7)
+			break;
+		memcpy(&id, p, 2);
+		memcpy(&pos, p + 2, 4);
+		c = p[6];
+		if (end - p < 7 + c)
+			break;
+
+		m = &l->markers[i];
+		m->id = ARRANGE_BE16(id);
+		m->position = ARRANGE_BE32(pos);
+		m->name = names;
+		memcpy(names, p + 7, c);
+		names[c] = '\0';
+		names += c + 1;
+
+		step = 7 + c + !(c & 1);	/* pad */
+		p += MIN(step, (size_t) (end - p));
+	}
+	if (i < n) {
+		/* truncated chunk */
+		free(l);
+		return (-1);
+	}
+	l->nMarkers = i;
+	qsort(l->markers, l->nMarkers, sizeof(AIFF_Marker), marker_cmp);
+
+	*list = l;
+	return (1);
+}
+
+/*
+ * Read the whole COMT chunk at once, like read_aifx_markers.
+ * The comments are left in file order.
+ * Return 1, 0 if there is no COMT chunk, or -1 on error.
+ */
+int 
+read_aifx_comments(AIFF_Ref r, AIFF_CommentList **list)
+{
+	AIFF_CommentList *l;
+	AIFF_Comment *c;
+	uint8_t *raw, *p, *end;
+	char *texts;
+	uint32_t cklen, ts;
+	uint16_t n, id, count;
+	size_t max, step, i;
+
+	*list = NULL;
+	if (!find_iff_chunk(AIFF_COMT, r, &cklen))
+		return (0);
+	if (cklen < 2)
+		return (-1);
+
+	/*
+	 * A comment takes at least 8 bytes in the chunk and
+	 * its text takes no more memory than it does on file.
+	 */
+	max = (cklen - 2) / 8;
+	l = malloc(sizeof(AIFF_CommentList) + max * sizeof(AIFF_Comment) +
+	    2 * (size_t) cklen);
+	if (l == NULL)
+		return (-1);
+	l->comments = (AIFF_Comment *) (l + 1);
+	texts = (char *) (l->comments + max);
+	raw = (uint8_t *) texts + cklen;
+	if (fread(raw, 1, cklen, r->fd) < cklen) {
+		free(l);
+		return (-1);
+	}
+
+	memcpy(&n, raw, 2);
+	n = ARRANGE_BE16(n);
+	p = raw + 2;
+	end = raw + cklen;
+	for (i = 0; i < n && i < max; i++) {
+		if (end - p < 8)
+			break;
+		memcpy(&ts, p, 4);
+		memcpy(&id, p + 4, 2);
+		memcpy(&count, p + 6, 2);
+		count = ARRANGE_BE16(count);
+		if (end - p < 8 + count)
+			break;
+
+		c = &l->comments[i];
+		c->timeStamp = ARRANGE_BE32(ts);
+		c->marker = ARRANGE_BE16(id);
+		c->text = texts;
+		memcpy(texts, p + 8, count);
+		texts[count] = '\0';
+		texts += count + 1;
+
+		step = 8 + count + (count & 1);	/* pad */
+		p += MIN(step, (size_t) (end - p));
+	}
+	if (i < n) {
+		/* truncated chunk */
+		free(l);
+		return (-1);
+	}
+	l->nComments = i;
+
+	*list = l;
+	return (1);
+}
+
+/*
+ * Return the largest id of the markers, with those of id 0 numbered
+ * after the others, as build_aifx_markers does. The markers can only
+ * be written if it is at most 0xFFFF.
+ */
+uint32_t
+last_aifx_marker_id(const AIFF_Marker *markers, size_t n)
+{
+	uint32_t last = 0;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		last = MAX(last, (uint32_t) markers[i].id);
+	for (i = 0; i < n; ++i) {
+		if (markers[i].id == 0)
+			last++;
+	}
+
+	return (last);
+}
+
+/*
+ * Make a whole MARK chunk (header included) in one allocated buffer.
+ * The markers with id 0 get the ids after the largest one given, in
+ * order, so that all ids are unique. Store in 'cklen' the chunk length.
+ * Return NULL if out of memory.
+ */
+uint8_t *
+build_aifx_markers(const AIFF_Marker *markers, size_t n, uint32_t *cklen)
+{
+	IFFChunk chk;
+	uint8_t *buf, *p;
+	uint32_t len, pos;
+	uint16_t v;
+	MarkerId next = 0;
+	size_t i, l;
+	const char *name;
+
+	ASSERT(n <= 0xFFFF);
+	ASSERT(last_aifx_marker_id(markers, n) <= 0xFFFF);
+	len = 2;
+	for (i = 0; i < n; ++i) {
+		name = markers[i].name;
+		len += 6 + (name ? PASCALOutGetLength(name) : 2);
+	}
+
+	if ((buf = malloc(8 + (size_t) len)) == NULL)
+		return (NULL);
+	ASSERT(sizeof(IFFChunk) == 8);
+	chk.id = ARRANGE_BE32(AIFF_MARK);
+	chk.len = ARRANGE_BE32(len);
+	memcpy(buf, &chk, 8);
+	v = (uint16_t) n;
+	v = ARRANGE_BE16(v);
+	memcpy(buf + 8, &v, 2);
+
+	for (i = 0; i < n; ++i)
+		next = MAX(next, markers[i].id);
+	p = buf + 10;
+	for (i = 0; i < n; ++i) {
+		v = (markers[i].id ? markers[i].id : ++next);
+		v = ARRANGE_BE16(v);
+		pos = (uint32_t) markers[i].position; /* XXX: AIFF is a 32-bit format */
+		pos = ARRANGE_BE32(pos);
+		memcpy(p, &v, 2);
+		memcpy(p + 2, &pos, 4);
+		p += 6;
+
+		name = (markers[i].name ? markers[i].name : "");
+		l = MIN(strlen(name), 0xFF);
+		*p++ = (uint8_t) l;
+		memcpy(p, name, l);
+		p += l;
+		if (!(l & 1))
+			*p++ = 0; /* pad */
+	}
+	ASSERT(p == buf + 8 + len);
+
+	*cklen = len;
+	return (buf);
+}
+
+/*
+ * Make a whole COMT chunk, like build_aifx_markers.
+ * Return NULL as well if the texts do not fit in a chunk.
+ */
+uint8_t *
+build_aifx_comments(const AIFF_Comment *comments, size_t n, uint32_t *cklen)
+{
+	IFFChunk chk;
+	uint8_t *buf, *p;
+	uint64_t total;
+	uint32_t len, ts;
+	uint16_t v;
+	size_t i, l;
+	const char *text;
+
+	ASSERT(n <= 0xFFFF);
+	total = 2;
+	for (i = 0; i < n; ++i) {
+		l = (comments[i].text ? MIN(strlen(comments[i].text), 0xFFFF) : 0);
+		total += 8 + l + (l & 1);
+	}
+	if (total > 0xFFFFFFFFU - 8)
+		return (NULL);
+	len = (uint32_t) total;
+
+	if ((buf = malloc(8 + (size_t) len)) == NULL)
+		return (NULL);
+	ASSERT(sizeof(IFFChunk) == 8);
+	chk.id = ARRANGE_BE32(AIFF_COMT);
+	chk.len = ARRANGE_BE32(len);
+	memcpy(buf, &chk, 8);
+	v = (uint16_t) n;
+	v = ARRANGE_BE16(v);
+	memcpy(buf + 8, &v, 2);
+
+	p = buf + 10;
+	for (i = 0; i < n; ++i) {
+		text = (comments[i].text ? comments[i].text : "");
+		l = MIN(strlen(text), 0xFFFF);
+		ts = ARRANGE_BE32(comments[i].timeStamp);
+		memcpy(p, &ts, 4);
+		v = ARRANGE_BE16(comments[i].marker);
+		memcpy(p + 4, &v, 2);
+		v = (uint16_t) l;
+		v = ARRANGE_BE16(v);
+		memcpy(p + 6, &v, 2);
+		memcpy(p + 8, text, l);
+		p += 8 + l;
+		if (l & 1)
+			*p++ = 0; /* pad */
+	}
+	ASSERT(p == buf + 8 + len);
+
+	*cklen = len;
+	return (buf);
+}
+
 int 
 get_aifx_instrument(AIFF_Ref r, Instrument * inpi)
 {
@@ -196,10 +544,9 @@ get_aifx_instrument(AIFF_Ref r, Instrument * inpi)
 	int16_t gain;
 	AIFFLoop sustainLoop, releaseLoop;
 	int ids[4];
-	int id;
-	uint32_t pos;
-	uint32_t positions[4];
-	char *name;
+	uint64_t positions[4];
+	AIFF_MarkerList *markers;
+	size_t j;
 
 	if (!find_iff_chunk(AIFF_INST, r, &cklen))
 		return (0);
@@ -231,19 +578,15 @@ get_aifx_instrument(AIFF_Ref r, Instrument * inpi)
 	ids[3] = ARRANGE_BE16(releaseLoop.endLoop);
 
 	/* Read the positions */
-	memset(positions, 0, 16 /* 4*4 */ );	/* by default set them to 0 */
-	for (;;) {
-		uint64_t p;
-		if (read_aifx_marker(r, &id, &p, &name) < 1) {
-			break;
-		}
-		pos = p;
-		if (name)
-			free(name);
-		for (i = 0; i < 4; ++i) {
-			if (id == ids[i])
-				positions[i] = pos;
+	memset(positions, 0, sizeof(positions));	/* by default set them to 0 */
+	if (read_aifx_markers(r, &markers) > 0) {
+		for (j = 0; j < markers->nMarkers; j++) {
+			for (i = 0; i < 4; ++i) {
+				if (markers->markers[j].id == ids[i])
+					positions[i] = markers->markers[j].position;
+			}
 		}
+		free(markers);
 	}
 
 	inpi->sustainLoop.beginLoop = positions[0];
@@ -291,6 +634,11 @@ do_aifx_prepare(AIFF_Ref r)
 			}
 		}
 	}
+	if (!(r->flags & F_NOTSEEKABLE)) {
+		if ((of = ftell(r->fd)) < 0)
+			return (-1);
+		r->dataOffset = (uint64_t) of;
+	}
 
 	return (1);
 }
@@ -0,0 +1,442 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Sound statistics, in one pass over the decoded samples.
+ *
+ * Each block of frames is split into one contiguous array per
+ * channel, so the per-channel loops below run over plain arrays of
+ * floats. In front of the samples of the block the array keeps the
+ * last kTaps-1 samples of the previous block, for the true-peak
+ * interpolator.
+ *
+ * Loudness follows ITU-R BS.1770: K-weighting (a high shelf and a
+ * high pass, made for the sampling rate of the file), the mean square
+ * of every channel over 400 ms blocks overlapping by 75%, and the
+ * absolute (-70 LKFS) and relative (-10 LU) gates. All the channels
+ * have a weight of 1.0: AIFF does not tell the surround channels apart.
+ */
+
+#define kAnalyzeBlock	4096	/* sample frames read at a time */
+#define kTaps		12	/* taps per phase of the true-peak interpolator */
+#define kPhases		4	/* oversampling of the true-peak interpolator */
+
+struct biquad {
+	double          b0, b1, b2, a1, a2;
+};
+
+struct s_AnalyzeChannel {
+	double          z[4];	/* K-weighting filter state */
+	double          sum;
+	double          sumSq;
+	double          kSumSq;	/* K-weighted, in the current 100 ms */
+	float           peak;
+	float           truePeak;
+	uint64_t        clipped;
+};
+
+struct s_Analyze {
+	int             nChannels;
+	float           clipHi, clipLo;
+	float           fir[kPhases][kTaps];
+	struct biquad   shelf, highPass;
+	struct s_AnalyzeChannel *ch;
+	float          *x;	/* per channel: kTaps-1 old samples, then the block */
+	uint64_t        stepFrames;	/* 100 ms */
+	uint64_t        stepFilled;
+	double          steps[3];	/* the last three 100 ms energies */
+	int             nSteps;
+	double         *blocks;	/* 400 ms mean squares */
+	size_t          nBlocks;
+	size_t          maxBlocks;
+};
+
+/*
+ * Polyphase windowed-sinc interpolator: phase p gives the
+ * sample p/kPhases of the way after x[n - kTaps/2].
+ */
+static void
+analyze_make_fir(struct s_Analyze *a)
+{
+	double          t, h, sum;
+	int             p, j, m, len = kPhases * kTaps;
+
+	for (p = 0; p < kPhases; p++) {
+		sum = 0;
+		for (j = 0; j < kTaps; j++) {
+			m = kPhases * j + p;
+			t = (double) (m - len / 2) / kPhases;
+			h = (m == len / 2 ? 1.0 : sin(M_PI * t) / (M_PI * t));
+			h *= 0.42 - 0.5 * cos(2 * M_PI * m / len) +
+			    0.08 * cos(4 * M_PI * m / len);
+			a->fir[p][kTaps - 1 - j] = (float) h;
+			sum += h;
+		}
+		for (j = 0; j < kTaps; j++)
+			a->fir[p][j] = (float) (a->fir[p][j] / sum);
+	}
+}
+
+/*
+ * The BS.1770 K-weighting filters, from their analog prototypes.
+ */
+static void
+analyze_make_kweight(struct s_Analyze *a, double rate)
+{
+	double          K, Q, Vh, Vb, a0;
+
+	K = tan(M_PI * 1681.974450955533 / rate);
+	Q = 0.7071752369554196;
+	Vh = pow(10.0, 3.999843853973347 / 20.0);
+	Vb = pow(Vh, 0.4996667741545416);
+	a0 = 1.0 + K / Q + K * K;
+	a->shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+	a->shelf.b1 = 2.0 * (K * K - Vh) / a0;
+	a->shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+	a->shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+	a->shelf.a2 = (1.0 - K / Q + K * K) / a0;
+
+	K = tan(M_PI * 38.13547087602444 / rate);
+	Q = 0.5003270373238773;
+	a0 = 1.0 + K / Q + K * K;
+	a->highPass.b0 = 1.0;
+	a->highPass.b1 = -2.0;
+	a->highPass.b2 = 1.0;
+	a->highPass.a1 = 2.0 * (K * K - 1.0) / a0;
+	a->highPass.a2 = (1.0 - K / Q + K * K) / a0;
+}
+
+/*
+ * The samples at or past which the encoding of 'r' clips.
+ */
+static void
+analyze_full_scale(AIFF_Ref r, float *hi, float *lo)
+{
+	switch (r->audioFormat) {
+	case AUDIO_FORMAT_ULAW:
+	case AUDIO_FORMAT_ulaw:
+		*hi = 32124.0f / 32768.0f;
+		*lo = -*hi;
+		break;
+	case AUDIO_FORMAT_ALAW:
+	case AUDIO_FORMAT_alaw:
+		*hi = 32256.0f / 32768.0f;
+		*lo = -*hi;
+		break;
+	case AUDIO_FORMAT_FL32:
+	case AUDIO_FORMAT_fl32:
+		*hi = 1.0f;
+		*lo = -1.0f;
+		break;
+	default:
+		*hi = (float) (1.0 - ldexp(1.0, 1 - r->bitsPerSample));
+		*lo = -1.0f;
+		break;
+	}
+}
+
+static int
+analyze_push_block(struct s_Analyze *a, double ms)
+{
+	double         *p;
+	size_t          n;
+
+	if (a->nBlocks == a->maxBlocks) {
+		n = (a->maxBlocks ? 2 * a->maxBlocks : 256);
+		if ((p = realloc(a->blocks, n * sizeof(double))) == NULL)
+			return (-1);
+		a->blocks = p;
+		a->maxBlocks = n;
+	}
+	a->blocks[a->nBlocks++] = ms;
+	return (1);
+}
+
+/*
+ * Close a 100 ms step; every step closes a 400 ms block
+ * once there are four of them.
+ */
+static int
+analyze_step(struct s_Analyze *a)
+{
+	double          e = 0;
+	int             c;
+
+	for (c = 0; c < a->nChannels; c++) {
+		e += a->ch[c].kSumSq;
+		a->ch[c].kSumSq = 0;
+	}
+	a->stepFilled = 0;
+	if (a->nSteps == 3 && analyze_push_block(a, (a->steps[0] + a->steps[1] +
+	    a->steps[2] + e) / (4 * a->stepFrames)) < 0)
+		return (-1);
+	a->steps[0] = a->steps[1];
+	a->steps[1] = a->steps[2];
+	a->steps[2] = e;
+	if (a->nSteps < 3)
+		a->nSteps++;
+	return (1);
+}
+
+/*
+ * Peaks, sums and clipped samples of the 'n' samples
+ * of one channel (the history is in front of 'h').
+ */
+static void
+analyze_levels(struct s_Analyze *a, struct s_AnalyzeChannel *s,
+    const float *h, unsigned int n)
+{
+	const float    *x = h + kTaps - 1;
+	float           v, y, pk = s->peak, tp = s->truePeak;
+	double          sum = 0, sumSq = 0;
+	uint64_t        clipped = 0;
+	unsigned int    i;
+	int             p, j;
+
+	for (i = 0; i < n; i++) {
+		v = x[i];
+		sum += v;
+		sumSq += (double) v * v;
+		clipped += (v >= a->clipHi || v <= a->clipLo);
+		v = (float) fabs(v);
+		pk = (v > pk ? v : pk);
+	}
+	/* phase 0 gives back the samples themselves */
+	for (p = 1; p < kPhases; p++) {
+		for (i = 0; i < n; i++) {
+			y = 0;
+			for (j = 0; j < kTaps; j++)
+				y += a->fir[p][j] * h[i + j];
+			y = (float) fabs(y);
+			tp = (y > tp ? y : tp);
+		}
+	}
+
+	s->sum += sum;
+	s->sumSq += sumSq;
+	s->peak = pk;
+	s->truePeak = MAX(tp, pk);
+	s->clipped += clipped;
+}
+
+/*
+ * K-weight samples 'from' to 'to' of one channel
+ * and add up their squares.
+ */
+static void
+analyze_kweight(struct s_Analyze *a, struct s_AnalyzeChannel *s,
+    const float *x, unsigned int from, unsigned int to)
+{
+	const struct biquad *f = &a->shelf, *g = &a->highPass;
+	double          z0 = s->z[0], z1 = s->z[1], z2 = s->z[2], z3 = s->z[3];
+	double          u, w, o, k = 0;
+	unsigned int    i;
+
+	/* transposed direct form II */
+	for (i = from; i < to; i++) {
+		u = x[i];
+		w = f->b0 * u + z0;
+		z0 = f->b1 * u - f->a1 * w + z1;
+		z1 = f->b2 * u - f->a2 * w;
+		o = g->b0 * w + z2;
+		z2 = g->b1 * w - g->a1 * o + z3;
+		z3 = g->b2 * w - g->a2 * o;
+		k += o * o;
+	}
+	s->z[0] = z0;
+	s->z[1] = z1;
+	s->z[2] = z2;
+	s->z[3] = z3;
+	s->kSumSq += k;
+}
+
+#define PLANE(a, c)	((a)->x + (size_t) (c) * (kTaps - 1 + kAnalyzeBlock))
+
+/*
+ * Feed 'n' interleaved frames.
+ */
+static int
+analyze_frames(struct s_Analyze *a, const float *buf, unsigned int n)
+{
+	float          *h;
+	unsigned int    i, from, to;
+	int             c, nc = a->nChannels;
+
+	for (c = 0; c < nc; c++) {
+		h = PLANE(a, c);
+		for (i = 0; i < n; i++)
+			h[kTaps - 1 + i] = buf[(size_t) i * nc + c];
+		analyze_levels(a, &a->ch[c], h, n);
+	}
+
+	/* K-weighting, one 100 ms step at a time */
+	for (from = 0; from < n; from += to) {
+		to = (unsigned int) MIN((uint64_t) (n - from), a->stepFrames - a->stepFilled);
+		for (c = 0; c < nc; c++)
+			analyze_kweight(a, &a->ch[c], PLANE(a, c) + kTaps - 1, from, from + to);
+		a->stepFilled += to;
+		if (a->stepFilled == a->stepFrames && analyze_step(a) < 0)
+			return (-1);
+	}
+
+	/* keep the last samples for the next block */
+	for (c = 0; c < nc; c++) {
+		h = PLANE(a, c);
+		memmove(h, h + n, (kTaps - 1) * sizeof(float));
+	}
+
+	return (1);
+}
+
+/*
+ * Integrated loudness of the gated blocks, in LKFS.
+ */
+static double
+analyze_loudness(struct s_Analyze *a)
+{
+	double          sum, gate;
+	size_t          i, n;
+	int             pass;
+
+	/* absolute gate, then relative gate */
+	gate = pow(10.0, (-70.0 + 0.691) / 10.0);
+	for (pass = 0; pass < 2; pass++) {
+		sum = 0;
+		n = 0;
+		for (i = 0; i < a->nBlocks; i++) {
+			if (a->blocks[i] > gate) {
+				sum += a->blocks[i];
+				n++;
+			}
+		}
+		if (n == 0)
+			return (-HUGE_VAL);
+		if (pass == 0)
+			gate = MAX(gate, sum / n * pow(10.0, -10.0 / 10.0));
+	}
+
+	return (-0.691 + 10.0 * log10(sum / n));
+}
+
+static void
+analyze_free(struct s_Analyze *a)
+{
+	free(a->ch);
+	free(a->x);
+	free(a->blocks);
+}
+
+/*
+ * Compute the statistics of the sound of 'r' in one pass. 'r' is
+ * read from the start (from where it is, if it is not seekable) to
+ * the end. 'stats->channels' is allocated, to be freed with
+ * AIFF_FreeStats.
+ */
+int
+AIFF_Analyze(AIFF_Ref r, AIFF_Stats * stats)
+{
+	struct s_Analyze a;
+	AIFF_ChannelStats *out;
+	float          *buf;
+	uint64_t        nFrames = 0;
+	int             c, n = 0, nc;
+
+	if (!r || !stats || !(r->flags & F_RDONLY) || r->prefetch ||
+	    r->resampler || r->nChannels < 1 || !(r->samplingRate > 0))
+		return (-1);
+	if (!(r->flags & F_NOTSEEKABLE) && AIFF_Seek(r, 0) < 0)
+		return (-1);
+
+	nc = r->nChannels;
+	memset(&a, 0, sizeof(a));
+	a.nChannels = nc;
+	analyze_full_scale(r, &a.clipHi, &a.clipLo);
+	a.stepFrames = (uint64_t) (r->samplingRate / 10.0 + 0.5);
+	if (a.stepFrames == 0)
+		a.stepFrames = 1;
+	analyze_make_fir(&a);
+	analyze_make_kweight(&a, r->samplingRate);
+
+	a.ch = calloc(nc, sizeof(struct s_AnalyzeChannel));
+	a.x = calloc((size_t) nc * (kTaps - 1 + kAnalyzeBlock), sizeof(float));
+	buf = malloc((size_t) kAnalyzeBlock * nc * sizeof(float));
+	out = malloc(nc * sizeof(AIFF_ChannelStats));
+	if (a.ch == NULL || a.x == NULL || buf == NULL || out == NULL)
+		goto fail;
+
+	while ((n = AIFF_ReadSamplesFloat(r, buf, kAnalyzeBlock * nc)) > 0) {
+		n /= nc;
+		if (n == 0)
+			break;
+		if (analyze_frames(&a, buf, (unsigned int) n) < 0)
+			goto fail;
+		nFrames += n;
+	}
+	if (n < 0)
+		goto fail;
+
+	for (c = 0; c < nc; c++) {
+		out[c].peak = a.ch[c].peak;
+		out[c].truePeak = a.ch[c].truePeak;
+		out[c].rms = (nFrames ? sqrt(a.ch[c].sumSq / nFrames) : 0);
+		out[c].dc = (nFrames ? a.ch[c].sum / nFrames : 0);
+		out[c].clipped = a.ch[c].clipped;
+	}
+	stats->nFrames = nFrames;
+	stats->nChannels = nc;
+	stats->loudness = analyze_loudness(&a);
+	stats->channels = out;
+	free(buf);
+	analyze_free(&a);
+
+	return (1);
+
+fail:
+	free(out);
+	free(buf);
+	analyze_free(&a);
+	return (-1);
+}
+
+void
+AIFF_FreeStats(AIFF_Stats * stats)
+{
+	if (stats) {
+		free(stats->channels);
+		stats->channels = NULL;
+	}
+}
@@ -0,0 +1,561 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#define _XOPEN_SOURCE 700	/* st_mtim */
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Open cache.
+ *
+ * Remembers, for each file opened through it, what the header
+ * parse found: the file format, the COMM chunk and the chunk table.
+ * An entry is keyed by the path and is valid as long as the device,
+ * inode, size and modification time (to the nanosecond, where the
+ * system records it) of the file are unchanged;
+ * a hit opens the file without reading a byte of it.
+ *
+ * Entries live in a fixed array, hashed by path in chained buckets,
+ * and are recycled in the order they were made. The cache can be
+ * saved to and loaded from a file, in host byte order; loaded
+ * entries are checked as a parsed header would be.
+ */
+
+#if defined(HAVE_SYS_TYPES_H) && defined(HAVE_SYS_STAT_H)
+#include <sys/types.h>
+#include <sys/stat.h>
+#define CACHE_STAT 1
+#endif
+#ifdef AIFF_THREADS
+#include <pthread.h>
+#define CACHE_LOCK(c)	pthread_mutex_lock(&(c)->lock)
+#define CACHE_UNLOCK(c)	pthread_mutex_unlock(&(c)->lock)
+#else
+#define CACHE_LOCK(c)
+#define CACHE_UNLOCK(c)
+#endif
+
+#define kCacheMagic	"LAIX"
+#define kCacheVersion	2
+#define kCacheMaxChunks	4096
+#define kCacheMaxPath	4096
+
+struct s_CacheEntry {
+	char           *path;	/* NULL if the entry is free */
+	uint32_t        hash;
+	int             next;	/* next entry in the bucket, or -1 */
+	uint64_t        dev;
+	uint64_t        ino;
+	uint64_t        size;
+	uint64_t        mtime;
+	AIFFIndex       idx;
+};
+
+struct s_AIFF_Cache {
+#ifdef AIFF_THREADS
+	pthread_mutex_t lock;
+#endif
+	struct s_CacheEntry *entries;
+	unsigned int    nEntries;
+	unsigned int    victim;	/* next entry to recycle */
+	int            *buckets;
+	unsigned int    mask;
+	uint64_t        hits;
+	uint64_t        misses;
+};
+
+/* FNV-1a */
+static uint32_t
+cache_hash(const char *s)
+{
+	uint32_t        h = 2166136261U;
+
+	while (*s) {
+		h ^= (uint8_t) * s++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+AIFF_CacheRef
+AIFF_CacheCreate(unsigned int nEntries)
+{
+	AIFF_CacheRef   c;
+	unsigned int    i, nb;
+
+	if (nEntries < 1 || nEntries > 0x1000000)
+		return (NULL);
+	for (nb = 1; nb < 2 * nEntries; nb <<= 1)
+		continue;
+
+	if ((c = malloc(sizeof(struct s_AIFF_Cache))) == NULL)
+		return (NULL);
+	c->entries = calloc(nEntries, sizeof(struct s_CacheEntry));
+	c->buckets = malloc(nb * sizeof(int));
+	if (c->entries == NULL || c->buckets == NULL) {
+		free(c->entries);
+		free(c->buckets);
+		free(c);
+		return (NULL);
+	}
+#ifdef AIFF_THREADS
+	if (pthread_mutex_init(&c->lock, NULL) != 0) {
+		free(c->entries);
+		free(c->buckets);
+		free(c);
+		return (NULL);
+	}
+#endif
+	for (i = 0; i < nb; i++)
+		c->buckets[i] = -1;
+	c->nEntries = nEntries;
+	c->mask = nb - 1;
+	c->victim = 0;
+	c->hits = c->misses = 0;
+
+	return (c);
+}
+
+void
+AIFF_CacheDelete(AIFF_CacheRef c)
+{
+	unsigned int    i;
+
+	if (!c)
+		return;
+	for (i = 0; i < c->nEntries; i++) {
+		free(c->entries[i].path);
+		free(c->entries[i].idx.chunks);
+	}
+#ifdef AIFF_THREADS
+	pthread_mutex_destroy(&c->lock);
+#endif
+	free(c->entries);
+	free(c->buckets);
+	free(c);
+}
+
+static struct s_CacheEntry *
+cache_lookup(AIFF_CacheRef c, const char *path, uint32_t hash)
+{
+	int             i;
+
+	for (i = c->buckets[hash & c->mask]; i >= 0; i = c->entries[i].next) {
+		if (c->entries[i].hash == hash &&
+		    strcmp(c->entries[i].path, path) == 0)
+			return (&c->entries[i]);
+	}
+	return (NULL);
+}
+
+/*
+ * Store 'idx' (whose chunk table is taken over) as the entry of 'path',
+ * replacing the previous entry of that path or else the oldest one.
+ */
+static int
+cache_insert(AIFF_CacheRef c, const char *path, const uint64_t key[4],
+    AIFFIndex * idx)
+{
+	struct s_CacheEntry *e;
+	uint32_t        hash = cache_hash(path);
+	int            *p;
+
+	if ((e = cache_lookup(c, path, hash)) == NULL) {
+		e = &c->entries[c->victim];
+		if (e->path) {
+			/* unlink the oldest entry */
+			for (p = &c->buckets[e->hash & c->mask]; *p != (int) c->victim;
+			    p = &c->entries[*p].next)
+				continue;
+			*p = e->next;
+			free(e->path);
+			free(e->idx.chunks);
+			e->path = NULL;
+		}
+		if ((e->path = malloc(strlen(path) + 1)) == NULL) {
+			free(idx->chunks);
+			return (-1);
+		}
+		strcpy(e->path, path);
+		e->hash = hash;
+		e->next = c->buckets[hash & c->mask];
+		c->buckets[hash & c->mask] = (int) c->victim;
+		c->victim = (c->victim + 1) % c->nEntries;
+	} else {
+		free(e->idx.chunks);
+	}
+	e->dev = key[0];
+	e->ino = key[1];
+	e->size = key[2];
+	e->mtime = key[3];
+	e->idx = *idx;
+
+	return (1);
+}
+
+/*
+ * Open 'file' for reading (see AIFF_OpenFile), using the cache
+ * to skip the header parse when the file has been seen already.
+ */
+AIFF_Ref
+AIFF_OpenCached(AIFF_CacheRef c, const char *file, int flags)
+{
+	AIFF_Ref        r;
+	FILE           *fd;
+#ifdef CACHE_STAT
+	struct stat     st;
+	struct s_CacheEntry *e;
+	AIFFIndex       idx;
+	uint64_t        key[4];
+	size_t          n;
+	int             hit = 0;
+#endif
+
+	if (!c || !file || !(flags & F_RDONLY) || (flags & (F_NOTSEEKABLE | F_RDWR)))
+		return (AIFF_OpenFile(file, flags));
+
+	if ((fd = fopen(file, "rb")) == NULL)
+		return (NULL);
+#ifdef CACHE_STAT
+	if (fstat(fileno(fd), &st) < 0) {
+		fclose(fd);
+		return (NULL);
+	}
+	key[0] = (uint64_t) st.st_dev;
+	key[1] = (uint64_t) st.st_ino;
+	key[2] = (uint64_t) st.st_size;
+	key[3] = (uint64_t) st.st_mtime * 1000000000;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+	key[3] += (uint64_t) st.st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+	key[3] += (uint64_t) st.st_mtimespec.tv_nsec;
+#endif
+
+	CACHE_LOCK(c);
+	e = cache_lookup(c, file, cache_hash(file));
+	if (e && e->dev == key[0] && e->ino == key[1] &&
+	    e->size == key[2] && e->mtime == key[3]) {
+		idx = e->idx;
+		n = (size_t) idx.nChunks * sizeof(IFFChunkEntry);
+		if ((idx.chunks = malloc(n ? n : 1)) != NULL) {
+			memcpy(idx.chunks, e->idx.chunks, n);
+			hit = 1;
+		}
+	}
+	if (hit)
+		c->hits++;
+	else
+		c->misses++;
+	CACHE_UNLOCK(c);
+
+	if (hit)
+		return (AIFFReadOpenStream(fd, flags, &idx));
+
+	if ((r = AIFFReadOpenStream(fd, flags, NULL)) == NULL || !r->chunks)
+		return (r);
+
+	idx.format = r->format;
+	idx.common.nSamples = r->nSamples;
+	idx.common.nChannels = r->nChannels;
+	idx.common.samplingRate = r->samplingRate;
+	idx.common.bitsPerSample = r->bitsPerSample;
+	idx.common.segmentSize = r->segmentSize;
+	idx.common.audioFormat = r->audioFormat;
+	idx.common.flags = r->flags & (LPCM_BIG_ENDIAN | LPCM_LTE_ENDIAN);
+	idx.nChunks = r->nChunks;
+	n = (size_t) r->nChunks * sizeof(IFFChunkEntry);
+	if ((idx.chunks = malloc(n ? n : 1)) != NULL) {
+		memcpy(idx.chunks, r->chunks, n);
+		CACHE_LOCK(c);
+		(void) cache_insert(c, file, key, &idx);
+		CACHE_UNLOCK(c);
+	}
+#else
+	CACHE_LOCK(c);
+	c->misses++;
+	CACHE_UNLOCK(c);
+	r = AIFFReadOpenStream(fd, flags, NULL);
+#endif
+
+	return (r);
+}
+
+/*
+ * Return the number of entries in use, and the
+ * number of hits and misses since the creation.
+ */
+int
+AIFF_CacheStats(AIFF_CacheRef c, uint64_t * hits, uint64_t * misses)
+{
+	unsigned int    i;
+	int             used = 0;
+
+	if (!c)
+		return (-1);
+	CACHE_LOCK(c);
+	for (i = 0; i < c->nEntries; i++) {
+		if (c->entries[i].path)
+			used++;
+	}
+	if (hits)
+		*hits = c->hits;
+	if (misses)
+		*misses = c->misses;
+	CACHE_UNLOCK(c);
+
+	return (used);
+}
+
+/*
+ * On-disk layout, in host byte order:
+ *
+ *	"LAIX", version (uint32), number of entries (uint32);
+ *	then for each entry
+ *	  path length (uint32), path,
+ *	  dev, inode, size, mtime in nanoseconds (uint64 each),
+ *	  format, audio format (uint32 each), number of frames (uint64),
+ *	  rate (double), channels, bits, segment size, flags (uint32 each),
+ *	  number of chunks (uint32), and for each chunk
+ *	    id, length (uint32 each), offset (uint64).
+ */
+
+static int
+put32(FILE * f, uint32_t v)
+{
+	return (fwrite(&v, 4, 1, f) == 1);
+}
+
+static int
+put64(FILE * f, uint64_t v)
+{
+	return (fwrite(&v, 8, 1, f) == 1);
+}
+
+static int
+get32(FILE * f, uint32_t * v)
+{
+	return (fread(v, 4, 1, f) == 1);
+}
+
+static int
+get64(FILE * f, uint64_t * v)
+{
+	return (fread(v, 8, 1, f) == 1);
+}
+
+static int
+cache_put(FILE * f, const struct s_CacheEntry *e)
+{
+	const AIFXFormat *cm = &e->idx.common;
+	uint32_t        len = (uint32_t) strlen(e->path);
+	int             i, ok;
+
+	ok = put32(f, len) && fwrite(e->path, 1, len, f) == len &&
+	    put64(f, e->dev) && put64(f, e->ino) &&
+	    put64(f, e->size) && put64(f, e->mtime) &&
+	    put32(f, e->idx.format) && put32(f, cm->audioFormat) &&
+	    put64(f, cm->nSamples) &&
+	    fwrite(&cm->samplingRate, sizeof(double), 1, f) == 1 &&
+	    put32(f, (uint32_t) cm->nChannels) &&
+	    put32(f, (uint32_t) cm->bitsPerSample) &&
+	    put32(f, (uint32_t) cm->segmentSize) &&
+	    put32(f, (uint32_t) cm->flags) &&
+	    put32(f, (uint32_t) e->idx.nChunks);
+	for (i = 0; ok && i < e->idx.nChunks; i++) {
+		ok = put32(f, e->idx.chunks[i].id) &&
+		    put32(f, e->idx.chunks[i].len) &&
+		    put64(f, e->idx.chunks[i].offset);
+	}
+
+	return (ok);
+}
+
+/*
+ * Save the cache to 'file'. Return the number
+ * of entries saved, or -1 on error.
+ */
+int
+AIFF_CacheSave(AIFF_CacheRef c, const char *file)
+{
+	FILE           *f;
+	unsigned int    i, k;
+	int             n = 0, ok;
+
+	if (!c || !file)
+		return (-1);
+	if ((f = fopen(file, "wb")) == NULL)
+		return (-1);
+
+	CACHE_LOCK(c);
+	for (i = 0; i < c->nEntries; i++) {
+		if (c->entries[i].path)
+			n++;
+	}
+	ok = fwrite(kCacheMagic, 1, 4, f) == 4 &&
+	    put32(f, kCacheVersion) && put32(f, (uint32_t) n);
+	/* oldest first, so that a load keeps the order */
+	for (i = 0; ok && i < c->nEntries; i++) {
+		k = (c->victim + i) % c->nEntries;
+		if (c->entries[k].path)
+			ok = cache_put(f, &c->entries[k]);
+	}
+	CACHE_UNLOCK(c);
+
+	if (fclose(f) != 0)
+		ok = 0;
+
+	return (ok ? n : -1);
+}
+
+/*
+ * Check a loaded entry the way a parse of the file would:
+ * a usable COMM chunk, and chunks that follow one another
+ * from the file header on and end within the file.
+ */
+static int
+cache_check(const uint64_t key[4], const AIFFIndex * idx)
+{
+	const IFFChunkEntry *t;
+	uint64_t        of = 12;
+	int             i;
+
+	if ((idx->format != AIFF_TYPE_AIFF && idx->format != AIFF_TYPE_AIFC) ||
+	    !check_aifx_common(&idx->common))
+		return (0);
+	for (i = 0; i < idx->nChunks; i++) {
+		t = &idx->chunks[i];
+		if (t->offset != of + 8 || t->offset > key[2] ||
+		    t->len > key[2] - t->offset)
+			return (0);
+		of = t->offset + t->len + (t->len & 1);
+	}
+
+	return (1);
+}
+
+/*
+ * Read one entry into 'path', 'key' and 'idx'.
+ * Return 1, -1 if the entry does not pass cache_check,
+ * or 0 if the file is short or corrupt.
+ */
+static int
+cache_get(FILE * f, char *path, uint64_t key[4], AIFFIndex * idx)
+{
+	AIFXFormat     *cm = &idx->common;
+	uint32_t        len, v[5];
+	int             i;
+
+	if (!get32(f, &len) || len < 1 || len >= kCacheMaxPath ||
+	    fread(path, 1, len, f) != len)
+		return (0);
+	path[len] = '\0';
+	if (!get64(f, &key[0]) || !get64(f, &key[1]) ||
+	    !get64(f, &key[2]) || !get64(f, &key[3]) ||
+	    !get32(f, &idx->format) || !get32(f, &cm->audioFormat) ||
+	    !get64(f, &cm->nSamples) ||
+	    fread(&cm->samplingRate, sizeof(double), 1, f) != 1)
+		return (0);
+	for (i = 0; i < 5; i++) {
+		if (!get32(f, &v[i]))
+			return (0);
+	}
+	if (v[4] > kCacheMaxChunks)
+		return (0);
+	cm->nChannels = (int) v[0];
+	cm->bitsPerSample = (int) v[1];
+	cm->segmentSize = (int) v[2];
+	cm->flags = (int) v[3] & (LPCM_BIG_ENDIAN | LPCM_LTE_ENDIAN);
+	idx->nChunks = (int) v[4];
+
+	idx->chunks = malloc((v[4] ? v[4] : 1) * sizeof(IFFChunkEntry));
+	if (idx->chunks == NULL)
+		return (0);
+	for (i = 0; i < idx->nChunks; i++) {
+		if (!get32(f, &idx->chunks[i].id) ||
+		    !get32(f, &idx->chunks[i].len) ||
+		    !get64(f, &idx->chunks[i].offset)) {
+			free(idx->chunks);
+			return (0);
+		}
+	}
+	if (!cache_check(key, idx)) {
+		free(idx->chunks);
+		return (-1);
+	}
+
+	return (1);
+}
+
+/*
+ * Load the entries saved in 'file' into the cache. Return the
+ * number of entries loaded, or -1 if the file could not be read
+ * or was not written by AIFF_CacheSave on this kind of host.
+ * Entries that fail cache_check are skipped.
+ */
+int
+AIFF_CacheLoad(AIFF_CacheRef c, const char *file)
+{
+	FILE           *f;
+	char            magic[4];
+	char           *path;
+	uint32_t        version, n, i;
+	uint64_t        key[4];
+	AIFFIndex       idx;
+	int             loaded = 0, res;
+
+	if (!c || !file)
+		return (-1);
+	if ((f = fopen(file, "rb")) == NULL)
+		return (-1);
+	if (fread(magic, 1, 4, f) != 4 || memcmp(magic, kCacheMagic, 4) != 0 ||
+	    !get32(f, &version) || version != kCacheVersion || !get32(f, &n) ||
+	    (path = malloc(kCacheMaxPath)) == NULL) {
+		fclose(f);
+		return (-1);
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((res = cache_get(f, path, key, &idx)) == 0)
+			break;
+		if (res < 0)
+			continue;
+		CACHE_LOCK(c);
+		if (cache_insert(c, path, key, &idx) > 0)
+			loaded++;
+		CACHE_UNLOCK(c);
+	}
+	free(path);
+	fclose(f);
+
+	return (loaded);
+}
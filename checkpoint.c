@@ -0,0 +1,373 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Crash safety for long recordings.
+ *
+ * While the samples are being written the FORM and SSND lengths and
+ * the sample frame count are only filled in by AIFF_EndWritingSamples.
+ * A checkpoint writes them as they stand and syncs the file, every
+ * so many bytes or seconds of writing; whatever happens to the writer
+ * later, the file is readable up to the last checkpoint.
+ *
+ * AIFF_RepairFile fixes up a file whose writer never finished it,
+ * taking the sound data to run to the end of the file.
+ */
+
+#if defined(HAVE_UNISTD_H) && (defined(HAVE_FDATASYNC) || defined(HAVE_FSYNC))
+#include <unistd.h>
+#ifdef HAVE_FDATASYNC
+#define SYNC_FD(fd)	fdatasync(fd)
+#else
+#define SYNC_FD(fd)	fsync(fd)
+#endif
+#endif
+
+struct s_AIFF_Checkpoint {
+	uint64_t        nBytes;	/* 0: not by size */
+	int             nSeconds;	/* 0: not by time */
+	uint64_t        lastBytes;
+	time_t          lastTime;
+};
+
+static int
+sync_file(FILE *fd)
+{
+	if (fflush(fd) != 0)
+		return (-1);
+#ifdef SYNC_FD
+	if (SYNC_FD(fileno(fd)) != 0)
+		return (-1);
+#endif
+	return (1);
+}
+
+static int
+put_be32(FILE *fd, uint64_t offset, uint32_t v)
+{
+	v = ARRANGE_BE32(v);
+	if (fseek(fd, (long) offset, SEEK_SET) < 0 ||
+	    fwrite(&v, 1, 4, fd) != 4)
+		return (-1);
+	return (1);
+}
+
+/*
+ * Write the lengths of what has been written so far,
+ * and come back to where the samples go.
+ */
+static int
+checkpoint_write(AIFF_Ref w)
+{
+	long at;
+
+	if (fflush(w->fd) != 0 || (at = ftell(w->fd)) < 0)
+		return (-1);
+	if (put_be32(w->fd, w->soundOffset + 4,
+	    (uint32_t) (w->sampleBytes + sizeof(SoundChunk))) < 0 ||
+	    put_be32(w->fd, w->commonOffset + 10,
+	    (uint32_t) (w->nSamples / w->nChannels)) < 0 ||
+	    put_be32(w->fd, 4, (uint32_t) w->len) < 0)
+		return (-1);
+	if (fseek(w->fd, at, SEEK_SET) < 0 || sync_file(w->fd) < 0)
+		return (-1);
+
+	if (w->checkpoint) {
+		w->checkpoint->lastBytes = w->sampleBytes;
+		if (w->checkpoint->nSeconds > 0)
+			w->checkpoint->lastTime = time(NULL);
+	}
+	return (1);
+}
+
+/*
+ * Called after each write of samples, by whoever writes them
+ * (the writer, or the worker of an asynchronous write).
+ */
+int
+checkpoint_update(AIFF_Ref w)
+{
+	struct s_AIFF_Checkpoint *c = w->checkpoint;
+
+	if (c == NULL)
+		return (1);
+	if (c->nBytes > 0 && w->sampleBytes - c->lastBytes >= c->nBytes)
+		return (checkpoint_write(w));
+	if (c->nSeconds > 0 && difftime(time(NULL), c->lastTime) >= c->nSeconds)
+		return (checkpoint_write(w));
+
+	return (1);
+}
+
+void
+checkpoint_destroy(AIFF_Ref w)
+{
+	free(w->checkpoint);
+	w->checkpoint = NULL;
+}
+
+/*
+ * Checkpoint every 'nBytes' bytes of sound data and/or every
+ * 'nSeconds' seconds; both 0 turn checkpoints off. Must be set
+ * before any asynchronous write is started.
+ */
+int
+AIFF_SetCheckpoint(AIFF_Ref w, uint64_t nBytes, int nSeconds)
+{
+	struct s_AIFF_Checkpoint *c;
+
+	if (!w || !(w->flags & F_WRONLY) || w->spool || nSeconds < 0)
+		return (-1);
+	if (nBytes == 0 && nSeconds == 0) {
+		checkpoint_destroy(w);
+		return (1);
+	}
+	if ((c = w->checkpoint) == NULL &&
+	    (c = malloc(sizeof(struct s_AIFF_Checkpoint))) == NULL)
+		return (-1);
+	c->nBytes = nBytes;
+	c->nSeconds = nSeconds;
+	c->lastBytes = (w->stat == 2 ? w->sampleBytes : 0);
+	c->lastTime = time(NULL);
+	w->checkpoint = c;
+
+	return (1);
+}
+
+/*
+ * Checkpoint now.
+ */
+int
+AIFF_Checkpoint(AIFF_Ref w)
+{
+	if (!w || !(w->flags & F_WRONLY) || w->spool)
+		return (-1);
+	if (w->stat != 2)
+		return (0);
+
+	return (checkpoint_write(w));
+}
+
+/*
+ * Recovery.
+ */
+
+static int
+read_chunk_header(FILE *fd, uint64_t at, IFFType *id, uint32_t *len)
+{
+	IFFChunk chk;
+
+	if (fseek(fd, (long) at, SEEK_SET) < 0 ||
+	    fread(&chk, 1, 8, fd) != 8)
+		return (-1);
+	*id = ARRANGE_BE32(chk.id);
+	*len = ARRANGE_BE32(chk.len);
+	return (1);
+}
+
+/*
+ * Whether the chunks from 'at' on look like a real chain of chunks
+ * that ends at the end of the file (the last one may be cut short),
+ * rather than sound data written after a stale SSND length.
+ */
+static int
+chunks_to_end(FILE *fd, uint64_t at, uint64_t size)
+{
+	IFFType id;
+	uint32_t len;
+	uint8_t *p;
+	int i;
+
+	while (at + 8 <= size) {
+		if (read_chunk_header(fd, at, &id, &len) < 0)
+			return (0);
+		p = (uint8_t *) &id;
+		for (i = 0; i < 4; i++) {
+			if (p[i] < 0x20 || p[i] > 0x7E)
+				return (0);
+		}
+		at += 8 + (uint64_t) len + (len & 1);
+	}
+	return (at >= size);
+}
+
+/*
+ * Repair a file whose writer did not finish it: the sound data is
+ * taken to run to the end of the file (if its stored length is zero,
+ * runs past the end of the file, or is followed by something that is
+ * not a chunk) or to the end of its chunk, and the SSND length, the
+ * sample frame count and the FORM length are set to match, dropping
+ * any partial sample frame. A chunk cut short by the end of the file is dropped.
+ * Return 1 if the file was repaired, 0 if it needed no repair,
+ * or -1 if it is not an Audio IFF file or on error.
+ */
+int
+AIFF_RepairFile(const char *file)
+{
+	FILE *fd;
+	IFFHeader hdr;
+	IFFType id;
+	AIFXFormat f;
+	SoundChunk s;
+	uint8_t buf[22];
+	uint32_t len, commLen = 0, ssndLen = 0, formLen, nFrames;
+	uint64_t size, at, end, next, comm = 0, ssnd = 0, frameBytes, avail;
+	long sz;
+	int toEnd = 0, changed = 0, ret = -1;
+
+	if ((fd = fopen(file, "r+b")) == NULL)
+		return (-1);
+	if (fseek(fd, 0, SEEK_END) < 0 || (sz = ftell(fd)) < 0)
+		goto out;
+	size = (uint64_t) sz;
+	if (fseek(fd, 0, SEEK_SET) < 0 || fread(&hdr, 1, 12, fd) != 12)
+		goto out;
+	if (hdr.hid != AIFF_TYPE_IFF ||
+	    (hdr.fid != AIFF_TYPE_AIFF && hdr.fid != AIFF_TYPE_AIFC))
+		goto out;
+
+	for (at = end = 12; at + 8 <= size; at = end) {
+		if (read_chunk_header(fd, at, &id, &len) < 0)
+			goto out;
+		next = at + 8 + (uint64_t) len + (len & 1);
+		if (id == AIFF_SSND && !ssnd) {
+			ssnd = at;
+			ssndLen = len;
+			/*
+			 * Trust the stored length unless it is unset, runs
+			 * past the end of the file or is followed by what
+			 * can only be more sound data (a stale checkpoint).
+			 */
+			if (len == 0 || at + 8 + (uint64_t) len > size ||
+			    (next < size && !chunks_to_end(fd, next, size))) {
+				/* the sound data runs to the end of the file */
+				if (size - at - 8 > 0xFFFFFFFFU)
+					goto out;
+				ssndLen = (uint32_t) (size - at - 8);
+				toEnd = 1;
+				break;
+			}
+		} else if (at + 8 + (uint64_t) len > size) {
+			break;	/* cut short */
+		} else if (id == AIFF_COMM && !comm) {
+			comm = at;
+			commLen = len;
+		}
+		end = next;
+	}
+	if (!comm || !ssnd || commLen < 18 || ssndLen < 8)
+		goto out;
+
+	/* bytes per sample frame, from the COMM chunk */
+	len = (commLen >= 22 && hdr.fid == AIFF_TYPE_AIFC ? 22 : 18);
+	if (fseek(fd, (long) comm + 8, SEEK_SET) < 0 ||
+	    fread(buf, 1, len, fd) != len)
+		goto out;
+	if (!parse_aifx_common(buf, commLen, hdr.fid, &f))
+		goto out;
+	switch (f.audioFormat) {
+	case AUDIO_FORMAT_LPCM:
+	case AUDIO_FORMAT_FL32:
+		frameBytes = (uint64_t) f.segmentSize * f.nChannels;
+		break;
+	case AUDIO_FORMAT_ALAW:
+	case AUDIO_FORMAT_ULAW:
+		frameBytes = (uint64_t) f.nChannels;
+		break;
+	default:
+		goto out;
+	}
+	if (frameBytes == 0)
+		goto out;
+
+	if (fseek(fd, (long) ssnd + 8, SEEK_SET) < 0 ||
+	    fread(&s, 1, 8, fd) != 8)
+		goto out;
+	s.offset = ARRANGE_BE32(s.offset);
+	if (s.offset > ssndLen - 8)
+		goto out;
+	avail = (ssndLen - 8 - s.offset) / frameBytes;
+	avail = MIN(avail, 0xFFFFFFFFU);
+
+	/*
+	 * Keep a smaller frame count found in a finished file;
+	 * that of an unfinished one is stale.
+	 */
+	nFrames = (uint32_t) avail;
+	if (!toEnd && f.nSamples <= avail)
+		nFrames = (uint32_t) f.nSamples;
+
+	if (toEnd) {
+		ssndLen = (uint32_t) (8 + s.offset + avail * frameBytes);
+		end = ssnd + 8 + ssndLen;
+		if (ssndLen & 1) {
+			/* pad byte */
+			if (fseek(fd, (long) end, SEEK_SET) < 0 ||
+			    putc(0, fd) == EOF)
+				goto out;
+			end++;
+		}
+	}
+	if (read_chunk_header(fd, ssnd, &id, &len) < 0)
+		goto out;
+	if (len != ssndLen) {
+		if (put_be32(fd, ssnd + 4, ssndLen) < 0)
+			goto out;
+		changed = 1;
+	}
+	if (nFrames != f.nSamples) {
+		if (put_be32(fd, comm + 10, nFrames) < 0)
+			goto out;
+		changed = 1;
+	}
+	if (end - 8 > 0xFFFFFFFFU)
+		goto out;
+	formLen = (uint32_t) (end - 8);
+	if (ARRANGE_BE32(hdr.len) != formLen) {
+		if (put_be32(fd, 4, formLen) < 0)
+			goto out;
+		changed = 1;
+	}
+	if (sync_file(fd) < 0)
+		goto out;
+	ret = changed;
+
+out:
+	if (fclose(fd) != 0)
+		ret = -1;
+	return (ret);
+}
@@ -0,0 +1,381 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Content checksums.
+ *
+ * The checksum is XXH64 (seed 0) of the canonical sample stream:
+ * every sample as a 32-bit big-endian word, left-justified as
+ * AIFF_ReadSamples32Bit returns it (G.711 samples expanded to linear),
+ * or the IEEE bits of the sample for floating point sounds. Byte
+ * order, sample container size, attributes, markers and chunk
+ * layout make no difference.
+ *
+ * The canonical stream is made from the sound data as stored on the
+ * file, so no sample is decoded: when reading, the sound data is read
+ * without going through the codec; when writing, every block is
+ * hashed just before it is written.
+ */
+
+#define U64(hi, lo)	(((uint64_t) (hi) << 32) | (uint64_t) (lo))
+#define PRIME64_1	U64(0x9E3779B1, 0x85EBCA87)
+#define PRIME64_2	U64(0xC2B2AE3D, 0x27D4EB4F)
+#define PRIME64_3	U64(0x165667B1, 0x9E3779F9)
+#define PRIME64_4	U64(0x85EBCA77, 0xC2B2AE63)
+#define PRIME64_5	U64(0x27D4EB2F, 0x165667C5)
+#define ROTL64(x, n)	(((x) << (n)) | ((x) >> (64 - (n))))
+
+#define kChecksumChunk	256	/* samples made canonical at a time */
+#define kChecksumBuf	65536	/* bytes read at a time */
+
+struct s_AIFF_Checksum {
+	uint64_t        v[4];
+	uint64_t        total;
+	uint8_t         mem[32];
+	unsigned int    memLen;
+	uint8_t         part[4];	/* an incomplete sample */
+	unsigned int    partLen;
+	int             haveTable;
+	int16_t         table[256];	/* G.711 expansion */
+};
+
+static uint64_t
+get_le64(const uint8_t * p)
+{
+	return (U64((uint32_t) p[4] | (uint32_t) p[5] << 8 |
+		(uint32_t) p[6] << 16 | (uint32_t) p[7] << 24,
+		(uint32_t) p[0] | (uint32_t) p[1] << 8 |
+		(uint32_t) p[2] << 16 | (uint32_t) p[3] << 24));
+}
+
+static uint32_t
+get_le32(const uint8_t * p)
+{
+	return ((uint32_t) p[0] | (uint32_t) p[1] << 8 |
+	    (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+}
+
+static uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = ROTL64(acc, 31);
+	return (acc * PRIME64_1);
+}
+
+static uint64_t
+xxh64_merge(uint64_t acc, uint64_t v)
+{
+	acc ^= xxh64_round(0, v);
+	return (acc * PRIME64_1 + PRIME64_4);
+}
+
+static void
+xxh64_reset(struct s_AIFF_Checksum *h)
+{
+	memset(h, 0, sizeof(struct s_AIFF_Checksum));
+	h->v[0] = PRIME64_1 + PRIME64_2;
+	h->v[1] = PRIME64_2;
+	h->v[2] = 0;
+	h->v[3] = (uint64_t) 0 - PRIME64_1;
+}
+
+static void
+xxh64_update(struct s_AIFF_Checksum *h, const uint8_t * p, size_t len)
+{
+	const uint8_t  *end = p + len;
+	uint64_t        v0, v1, v2, v3;
+	unsigned int    n;
+
+	h->total += len;
+	if (h->memLen + len < 32) {
+		memcpy(h->mem + h->memLen, p, len);
+		h->memLen += (unsigned int) len;
+		return;
+	}
+	if (h->memLen > 0) {
+		n = 32 - h->memLen;
+		memcpy(h->mem + h->memLen, p, n);
+		h->v[0] = xxh64_round(h->v[0], get_le64(h->mem));
+		h->v[1] = xxh64_round(h->v[1], get_le64(h->mem + 8));
+		h->v[2] = xxh64_round(h->v[2], get_le64(h->mem + 16));
+		h->v[3] = xxh64_round(h->v[3], get_le64(h->mem + 24));
+		p += n;
+		h->memLen = 0;
+	}
+
+	v0 = h->v[0];
+	v1 = h->v[1];
+	v2 = h->v[2];
+	v3 = h->v[3];
+	for (; end - p >= 32; p += 32) {
+		v0 = xxh64_round(v0, get_le64(p));
+		v1 = xxh64_round(v1, get_le64(p + 8));
+		v2 = xxh64_round(v2, get_le64(p + 16));
+		v3 = xxh64_round(v3, get_le64(p + 24));
+	}
+	h->v[0] = v0;
+	h->v[1] = v1;
+	h->v[2] = v2;
+	h->v[3] = v3;
+
+	if (p < end) {
+		memcpy(h->mem, p, (size_t) (end - p));
+		h->memLen = (unsigned int) (end - p);
+	}
+}
+
+static uint64_t
+xxh64_digest(const struct s_AIFF_Checksum *h)
+{
+	const uint8_t  *p = h->mem, *end = h->mem + h->memLen;
+	uint64_t        r;
+
+	if (h->total >= 32) {
+		r = ROTL64(h->v[0], 1) + ROTL64(h->v[1], 7) +
+		    ROTL64(h->v[2], 12) + ROTL64(h->v[3], 18);
+		r = xxh64_merge(r, h->v[0]);
+		r = xxh64_merge(r, h->v[1]);
+		r = xxh64_merge(r, h->v[2]);
+		r = xxh64_merge(r, h->v[3]);
+	} else {
+		r = PRIME64_5;
+	}
+	r += h->total;
+
+	for (; end - p >= 8; p += 8) {
+		r ^= xxh64_round(0, get_le64(p));
+		r = ROTL64(r, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (end - p >= 4) {
+		r ^= (uint64_t) get_le32(p) * PRIME64_1;
+		r = ROTL64(r, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		r ^= (uint64_t) * p * PRIME64_5;
+		r = ROTL64(r, 11) * PRIME64_1;
+	}
+
+	r ^= r >> 33;
+	r *= PRIME64_2;
+	r ^= r >> 29;
+	r *= PRIME64_3;
+	r ^= r >> 32;
+
+	return (r);
+}
+
+static int
+is_g711(IFFType fmt)
+{
+	return (fmt == AUDIO_FORMAT_ULAW || fmt == AUDIO_FORMAT_ulaw ||
+	    fmt == AUDIO_FORMAT_ALAW || fmt == AUDIO_FORMAT_alaw);
+}
+
+/*
+ * Hash 'n' whole samples, as stored on the file.
+ */
+static void
+checksum_samples(AIFF_Ref r, struct s_AIFF_Checksum *h, const uint8_t * p, size_t n)
+{
+	uint8_t         out[4 * kChecksumChunk], *q;
+	size_t          i, m;
+	int             seg = r->segmentSize, j;
+	int16_t         v;
+
+	if (is_g711(r->audioFormat) && !h->haveTable) {
+		g711_table(r->audioFormat, h->table);
+		h->haveTable = 1;
+	}
+
+	while (n > 0) {
+		m = MIN(n, (size_t) kChecksumChunk);
+		q = out;
+		if (is_g711(r->audioFormat)) {
+			for (i = 0; i < m; i++, q += 4) {
+				v = h->table[*p++];
+				q[0] = (uint8_t) ((uint16_t) v >> 8);
+				q[1] = (uint8_t) v;
+				q[2] = q[3] = 0;
+			}
+		} else if (r->audioFormat == AUDIO_FORMAT_FL32 ||
+		    r->audioFormat == AUDIO_FORMAT_fl32 ||
+		    !(r->flags & LPCM_LTE_ENDIAN)) {
+			/* big-endian: left-justify */
+			for (i = 0; i < m; i++, q += 4, p += seg) {
+				for (j = 0; j < seg; j++)
+					q[j] = p[j];
+				for (; j < 4; j++)
+					q[j] = 0;
+			}
+		} else {
+			for (i = 0; i < m; i++, q += 4, p += seg) {
+				for (j = 0; j < seg; j++)
+					q[j] = p[seg - 1 - j];
+				for (; j < 4; j++)
+					q[j] = 0;
+			}
+		}
+		xxh64_update(h, out, (size_t) (q - out));
+		n -= m;
+	}
+}
+
+/*
+ * Hash 'len' bytes of sound data as stored on the file
+ * (not necessarily whole samples).
+ */
+static void
+checksum_bytes(AIFF_Ref r, struct s_AIFF_Checksum *h, const void *data, size_t len)
+{
+	const uint8_t  *p = data;
+	size_t          seg = (size_t) r->segmentSize, n;
+
+	if (is_g711(r->audioFormat))
+		seg = 1;
+	if (seg < 1 || seg > 4)
+		return;
+	if (h->partLen > 0) {
+		n = MIN(len, seg - h->partLen);
+		memcpy(h->part + h->partLen, p, n);
+		h->partLen += (unsigned int) n;
+		p += n;
+		len -= n;
+		if (h->partLen < seg)
+			return;
+		checksum_samples(r, h, h->part, 1);
+		h->partLen = 0;
+	}
+	checksum_samples(r, h, p, len / seg);
+	p += len - len % seg;
+	h->partLen = (unsigned int) (len % seg);
+	memcpy(h->part, p, h->partLen);
+}
+
+/*
+ * Writer side: hash a block of sound data just before it is written.
+ */
+void
+checksum_update(AIFF_Ref w, const void *data, size_t len)
+{
+	if (w->checksum)
+		checksum_bytes(w, w->checksum, data, len);
+}
+
+void
+checksum_destroy(AIFF_Ref w)
+{
+	free(w->checksum);
+	w->checksum = NULL;
+}
+
+/*
+ * Checksum the sound of 'r' (not reading ahead, seekable) in one
+ * pass over the sound data. 'r' is left at the start of the sound.
+ */
+int
+AIFF_Checksum(AIFF_Ref r, uint64_t * hash)
+{
+	struct s_AIFF_Checksum h;
+	uint8_t        *buf;
+	uint64_t        done = 0, len;
+	size_t          n;
+	int             res = 1;
+
+	if (!r || !hash || !(r->flags & F_RDONLY) || r->prefetch ||
+	    (r->flags & F_NOTSEEKABLE))
+		return (-1);
+	if (AIFFPrepare(r) < 1)
+		return (-1);
+	if ((buf = malloc(kChecksumBuf)) == NULL)
+		return (-1);
+
+	xxh64_reset(&h);
+	len = r->nSamples * AIFFFrameSize(r);
+	if (FSEEKO(r->fd, (OFF_T) r->dataOffset, SEEK_SET) < 0)
+		res = -1;
+	while (res > 0 && done < len) {
+		n = (size_t) MIN(len - done, (uint64_t) kChecksumBuf);
+		if (fread(buf, 1, n, r->fd) != n) {
+			res = -1;
+			break;
+		}
+		checksum_bytes(r, &h, buf, n);
+		done += n;
+	}
+	free(buf);
+	/* put the stream back in step with the codec */
+	if (AIFF_Seek(r, 0) < 0)
+		res = -1;
+	if (res < 1)
+		return (res);
+
+	*hash = xxh64_digest(&h);
+	return (1);
+}
+
+/*
+ * Start checksumming the sound written to 'w', which must have no
+ * samples yet and must not be an asynchronous writer yet.
+ */
+int
+AIFF_StartChecksum(AIFF_Ref w)
+{
+	if (!w || !(w->flags & F_WRONLY) || (w->flags & F_APPEND) ||
+	    w->stat > 2 || w->spool || w->checksum)
+		return (-1);
+	if (w->stat == 2 && w->nSamples > 0)
+		return (-1);
+	if ((w->checksum = malloc(sizeof(struct s_AIFF_Checksum))) == NULL)
+		return (-1);
+	xxh64_reset(w->checksum);
+
+	return (1);
+}
+
+/*
+ * Store the checksum of the sound written to 'w' so far.
+ */
+int
+AIFF_GetChecksum(AIFF_Ref w, uint64_t * hash)
+{
+	if (!w || !hash || !w->checksum || w->spool)
+		return (-1);
+
+	*hash = xxh64_digest(w->checksum);
+	return (1);
+}
@@ -0,0 +1,327 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE 1	/* copy_file_range */
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Copying sample frames between files.
+ *
+ * When both files store the samples the same way, the bytes of the
+ * sound data are copied as they are: by the kernel, file to file, if
+ * it can (copy_file_range), else through a buffer. Otherwise the frames
+ * are decoded and encoded again. The markers of the source that fall
+ * in the range go along, moved to where the range lands.
+ */
+
+#if defined(HAVE_COPY_FILE_RANGE) && defined(HAVE_UNISTD_H)
+#include <sys/types.h>
+#include <unistd.h>
+#define COPY_KERNEL 1
+#endif
+
+#define kCopyBufSize	65536	/* in bytes, for raw copies */
+#define kCopyFrames	4096	/* in sample frames, for conversions */
+
+static int
+copy_same_encoding(AIFF_Ref w, AIFF_Ref r)
+{
+	if (w->audioFormat != r->audioFormat || w->nChannels != r->nChannels ||
+	    w->segmentSize != r->segmentSize)
+		return (0);
+	if (w->audioFormat != AUDIO_FORMAT_LPCM)
+		return (1);
+	if (w->bitsPerSample != r->bitsPerSample)
+		return (0);
+	return (w->segmentSize == 1 ||
+	    (w->flags & LPCM_LTE_ENDIAN) == (r->flags & LPCM_LTE_ENDIAN));
+}
+
+#ifdef COPY_KERNEL
+/*
+ * Let the kernel copy what it can of the 'len' bytes at 'offset';
+ * return the number of bytes copied.
+ */
+static uint64_t
+copy_kernel(AIFF_Ref w, AIFF_Ref r, uint64_t offset, uint64_t len)
+{
+	loff_t in = (loff_t) offset, out;
+	long at;
+	ssize_t n;
+
+	if (fflush(w->fd) != 0 || (at = ftell(w->fd)) < 0)
+		return (0);
+	out = at;
+	while (len > 0) {
+		n = copy_file_range(fileno(r->fd), &in, fileno(w->fd), &out,
+		    (size_t) MIN(len, (uint64_t) 0x40000000), 0);
+		if (n <= 0)
+			break;	/* not supported here, or error: let stdio try */
+		len -= (uint64_t) n;
+	}
+	if (fseek(w->fd, (long) out, SEEK_SET) < 0)
+		return (0);
+	return ((uint64_t) (out - at));
+}
+#endif
+
+/*
+ * Copy the 'len' bytes at 'offset' of the sound data of 'r'.
+ */
+static int
+copy_raw(AIFF_Ref w, AIFF_Ref r, uint64_t offset, uint64_t len)
+{
+	uint8_t *buf;
+	uint64_t done = 0, nSamples = w->nSamples;
+	size_t n;
+	int res = 1;
+	STATS_TIMER(t)
+
+#ifdef COPY_KERNEL
+	if (w->checksum == NULL)	/* the data has to pass through here */
+		done = copy_kernel(w, r, offset, len);
+#endif
+	if (done < len) {
+		if ((buf = malloc(kCopyBufSize)) == NULL)
+			return (-1);
+		while (done < len) {
+			n = (size_t) MIN(len - done, (uint64_t) kCopyBufSize);
+			STATS_START(t);
+			STATS_ADD(r, seeks, 1);
+			if (fseek(r->fd, (long) (offset + done), SEEK_SET) < 0 ||
+			    fread(buf, 1, n, r->fd) != n) {
+				res = -1;
+				break;
+			}
+			STATS_READ(r, n, t);
+			checksum_update(w, buf, n);
+			STATS_START(t);
+			if (fwrite(buf, 1, n, w->fd) != n) {
+				res = -1;
+				break;
+			}
+			STATS_WRITE(w, n, t);
+			done += n;
+		}
+		free(buf);
+	}
+	w->nSamples = nSamples + done / (AIFFFrameSize(w) / w->nChannels);
+	w->sampleBytes += done;
+	w->len += done;
+	if (res < 1)
+		return (res);
+
+	return (checkpoint_update(w));
+}
+
+/*
+ * Decode and encode again.
+ */
+static int
+copy_convert(AIFF_Ref w, AIFF_Ref r, uint64_t start, uint64_t nFrames)
+{
+	int32_t *buf;
+	int n, res = 1;
+
+	if ((buf = malloc(kCopyFrames * sizeof(int32_t) * r->nChannels)) == NULL)
+		return (-1);
+	if (AIFF_Seek(r, start) < 1)
+		res = -1;
+	while (nFrames > 0 && res > 0) {
+		n = (int) MIN(nFrames, (uint64_t) kCopyFrames) * r->nChannels;
+		if ((n = AIFF_ReadSamples32Bit(r, buf, n)) < 1) {
+			res = (n < 0 ? -1 : 1);
+			break;
+		}
+		if (AIFF_WriteSamples32Bit(w, buf, n) < 0)
+			res = -1;
+		nFrames -= (uint64_t) (n / r->nChannels);
+	}
+	free(buf);
+
+	return (res);
+}
+
+/*
+ * Copy 'nFrames' sample frames of 'src' from 'startFrame' on to the
+ * samples being written to 'dst' (not an asynchronous writer). The
+ * markers in the range are queued to be written with those of 'dst'.
+ * 'src' is left positioned after the range. Return 1, 0 if there is
+ * nothing to copy, or -1 on error.
+ */
+int
+AIFF_CopyFrames(AIFF_Ref dst, AIFF_Ref src, uint64_t startFrame, uint64_t nFrames)
+{
+	AIFF_MarkerList *ml;
+	uint64_t avail, dstFrame, pos;
+	size_t i;
+	int res;
+
+	if (!dst || !(dst->flags & F_WRONLY) || dst->stat != 2 || dst->spool)
+		return (-1);
+	if (!src || !(src->flags & F_RDONLY) || (src->flags & F_NOTSEEKABLE) ||
+	    src->prefetch || src->resampler || src->nChannels != dst->nChannels)
+		return (-1);
+
+	if (AIFFPrepare(src) < 1)
+		return (-1);
+	avail = MIN(src->nSamples, src->soundLen / AIFFFrameSize(src));
+	if (startFrame >= avail || nFrames == 0)
+		return (0);
+	nFrames = MIN(nFrames, avail - startFrame);
+
+	if (!(dst->flags & F_APPEND)) {
+		if ((res = AIFF_ReadAllMarkers(src, &ml)) < 0)
+			return (-1);
+		if (res > 0) {
+			dstFrame = dst->nSamples / dst->nChannels;
+			for (i = 0; i < ml->nMarkers && res > 0; i++) {
+				pos = ml->markers[i].position;
+				if (pos >= startFrame && pos - startFrame <= nFrames)
+					res = AIFFQueueMarker(dst, dstFrame + pos - startFrame,
+					    ml->markers[i].name);
+			}
+			AIFF_FreeMarkers(ml);
+			if (res < 0)
+				return (-1);
+		}
+		/* reading the markers unprepared 'src' */
+		if (AIFFPrepare(src) < 1)
+			return (-1);
+	}
+
+	if (copy_same_encoding(dst, src)) {
+		res = copy_raw(dst, src, src->dataOffset +
+		    startFrame * AIFFFrameSize(src), nFrames * AIFFFrameSize(src));
+		if (res > 0 && AIFF_Seek(src, startFrame + nFrames) < 0)
+			res = -1;
+	} else {
+		res = copy_convert(dst, src, startFrame, nFrames);
+	}
+
+	return (res);
+}
+
+static int
+concat_compatible(const AIFF_Info * a, const AIFF_Info * b)
+{
+	if (a->encoding != b->encoding || a->channels != b->channels ||
+	    a->bitsPerSample != b->bitsPerSample ||
+	    a->segmentSize != b->segmentSize ||
+	    a->samplingRate < b->samplingRate || a->samplingRate > b->samplingRate)
+		return (0);
+	return (a->encoding != AUDIO_FORMAT_LPCM || a->segmentSize == 1 ||
+	    (a->flags & LPCM_LTE_ENDIAN) == (b->flags & LPCM_LTE_ENDIAN));
+}
+
+/*
+ * Join the sound of the 'n' files in 'inputs' into the new file 'out',
+ * in the format of the first one, which gives the attributes too.
+ * All the inputs must have the same sound format; their headers are
+ * checked before anything is written. The sound data is copied with
+ * AIFF_CopyFrames and the markers are moved onto the new timeline.
+ * Return 1, or -1 on error (and 'out' is removed).
+ */
+int
+AIFF_Concatenate(const char *out, const char **inputs, int n)
+{
+	AIFF_Info *infos;
+	AIFF_Ref r, w = NULL;
+	int *results, flags, bits, i, res = -1;
+
+	if (!out || !inputs || n < 1)
+		return (-1);
+	infos = malloc((size_t) n * sizeof(AIFF_Info));
+	results = malloc((size_t) n * sizeof(int));
+	if (infos == NULL || results == NULL)
+		goto out;
+
+	/* check all the headers first */
+	if (AIFF_ProbeMany(inputs, infos, results, n, 0) != n)
+		goto out;
+	for (i = 1; i < n; i++) {
+		if (!concat_compatible(&infos[0], &infos[i]))
+			goto out;
+	}
+	switch (infos[0].encoding) {
+	case AUDIO_FORMAT_LPCM:
+		bits = infos[0].bitsPerSample;
+		break;
+	case AUDIO_FORMAT_ALAW:
+	case AUDIO_FORMAT_ULAW:
+		bits = 16;
+		break;
+	default:
+		goto out;	/* not writable */
+	}
+	flags = infos[0].flags & (F_AIFC | LPCM_LTE_ENDIAN | LPCM_BIG_ENDIAN);
+
+	if ((r = AIFF_OpenFile(inputs[0], F_RDONLY)) == NULL)
+		goto out;
+	if ((w = AIFF_OpenFile(out, F_WRONLY | flags)) == NULL) {
+		AIFF_CloseFile(r);
+		goto out;
+	}
+	if (AIFF_CloneAttributes(w, r, 0) < 0 ||
+	    AIFF_SetAudioEncoding(w, infos[0].encoding) < 1 ||
+	    AIFF_SetAudioFormat(w, infos[0].channels, infos[0].samplingRate, bits) < 1 ||
+	    AIFF_StartWritingSamples(w) < 1) {
+		AIFF_CloseFile(r);
+		goto out;
+	}
+
+	for (i = 0; ; ) {
+		if (AIFF_CopyFrames(w, r, 0, r->nSamples) < 0) {
+			AIFF_CloseFile(r);
+			goto out;
+		}
+		AIFF_CloseFile(r);
+		if (++i == n)
+			break;
+		if ((r = AIFF_OpenFile(inputs[i], F_RDONLY)) == NULL)
+			goto out;
+	}
+	if (AIFF_EndWritingSamples(w) < 1)
+		goto out;
+	res = 1;
+
+out:
+	if (w && AIFF_CloseFile(w) < 0)
+		res = -1;
+	if (w && res < 1)
+		remove(out);
+	free(results);
+	free(infos);
+	return (res);
+}
@@ -0,0 +1,725 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE 1
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Read engine.
+ *
+ * Many open files submit reads of their sound data to one shared
+ * engine; the caller polls for the completed blocks, which arrive
+ * already decoded to floating point. One thread can so keep
+ * hundreds of streams going.
+ *
+ * There are two back-ends: a Linux io_uring, driven from the
+ * polling thread (the reads are submitted in batches, with a single
+ * system call per poll), and a pool of threads doing pread(2).
+ * Neither of them touches the stdio stream of the files.
+ *
+ * The raw bytes are read into the tail of the caller's buffer and
+ * decoded in place there (see lpcm_read_float32), so the engine
+ * does not need any buffer of its own.
+ *
+ * The engine is to be used (submit, poll) from one thread only.
+ */
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_SYSCALL_H) && \
+    defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_UIO_H) && \
+    defined(HAVE_UNISTD_H) && defined(HAVE_ATOMIC_BUILTINS)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ENGINE_URING 1
+#endif
+#endif
+
+#ifdef AIFF_PREAD
+#include <unistd.h>
+#endif
+
+#if defined(AIFF_THREADS) && defined(AIFF_PREAD)
+#include <pthread.h>
+#define ENGINE_THREADS 1
+#endif
+
+#define kEngineMaxDepth		4096
+#define kEngineDefThreads	4
+
+struct s_EngineRequest {
+	AIFF_Ref        ref;
+	void           *userData;
+	float          *samples;
+	uint8_t        *raw;	/* the tail of 'samples' */
+	size_t          bytes;
+	uint64_t        offset;	/* in the file */
+	int             fd;
+	long            result;	/* bytes read, or -1 */
+	int             next;
+#ifdef ENGINE_URING
+	struct iovec    iov;
+#endif
+};
+
+#ifdef ENGINE_URING
+struct s_URing {
+	int             fd;
+	unsigned int   *sqTail;
+	unsigned int   *sqMask;
+	unsigned int   *sqArray;
+	unsigned int   *cqHead;
+	unsigned int   *cqTail;
+	unsigned int   *cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void           *sqMap;
+	void           *cqMap;
+	size_t          sqMapLen;
+	size_t          cqMapLen;
+	size_t          sqesLen;
+	unsigned int    unsubmitted;
+	unsigned int    reading;	/* submitted, not reaped */
+};
+#endif
+
+struct s_AIFF_Engine {
+	int             backend;
+	int             depth;
+	struct s_EngineRequest *req;
+	int             freeList;
+	int             doneHead;
+	int             doneTail;
+	unsigned int    pending;	/* submitted, not yet polled */
+#ifdef ENGINE_URING
+	struct s_URing  ring;
+#endif
+#ifdef ENGINE_THREADS
+	pthread_mutex_t lock;
+	pthread_cond_t  work;
+	pthread_cond_t  done;
+	pthread_t      *threads;
+	int             nThreads;
+	int             quit;
+	int             todoHead;
+	int             todoTail;
+#endif
+};
+
+/*
+ * Request lists (FIFO), linked by index.
+ */
+static void
+list_push(struct s_EngineRequest *req, int *head, int *tail, int i)
+{
+	req[i].next = -1;
+	if (*tail < 0)
+		*head = i;
+	else
+		req[*tail].next = i;
+	*tail = i;
+}
+
+static void
+engine_complete(AIFF_EngineRef e, int i)
+{
+#ifdef ENGINE_THREADS
+	if (e->backend == kEngineThreads) {
+		pthread_mutex_lock(&e->lock);
+		list_push(e->req, &e->doneHead, &e->doneTail, i);
+		pthread_cond_signal(&e->done);
+		pthread_mutex_unlock(&e->lock);
+		return;
+	}
+#endif
+	list_push(e->req, &e->doneHead, &e->doneTail, i);
+}
+
+#if defined(ENGINE_URING) || defined(ENGINE_THREADS)
+
+static int
+list_pop(struct s_EngineRequest *req, int *head, int *tail)
+{
+	int             i = *head;
+
+	if (i >= 0) {
+		*head = req[i].next;
+		if (*head < 0)
+			*tail = -1;
+	}
+	return (i);
+}
+
+/*
+ * Decode the bytes read, dropping any partial frame.
+ */
+static void
+engine_decode(struct s_EngineRequest *q)
+{
+	AIFF_Ref        r = q->ref;
+	long            fs = AIFFFrameSize(r);
+
+	if (q->result <= 0)
+		return;
+	q->result -= q->result % fs;
+	r->codec->decode_float32(r, q->raw, q->samples,
+	    (int) (q->result / fs) * r->nChannels);
+}
+
+/*
+ * Hand out up to 'maxc' completed requests and recycle them.
+ */
+static int
+engine_collect(AIFF_EngineRef e, AIFF_Completion * c, int maxc)
+{
+	struct s_EngineRequest *q;
+	int             i, n = 0;
+
+	while (n < maxc && (i = list_pop(e->req, &e->doneHead, &e->doneTail)) >= 0) {
+		q = &e->req[i];
+		c[n].ref = q->ref;
+		c[n].userData = q->userData;
+		c[n].samples = q->samples;
+		if (q->result < 0)
+			c[n].nFrames = -1;
+		else
+			c[n].nFrames = (int) (q->result / AIFFFrameSize(q->ref));
+		q->next = e->freeList;
+		e->freeList = i;
+		e->pending--;
+		n++;
+	}
+
+	return (n);
+}
+
+#endif /* ENGINE_URING || ENGINE_THREADS */
+
+#ifdef AIFF_PREAD
+
+/*
+ * Read 'len' bytes at 'offset', unless the end of the file comes
+ * first. Return the number of bytes read, or -1 on error.
+ */
+long
+engine_pread(int fd, void *buf, size_t len, uint64_t offset)
+{
+	size_t          done = 0;
+	ssize_t         n;
+
+	while (done < len) {
+		n = pread(fd, (uint8_t *) buf + done, len - done,
+		    (off_t) (offset + done));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		if (n == 0)
+			break;
+		done += (size_t) n;
+	}
+
+	return ((long) done);
+}
+
+#endif /* AIFF_PREAD */
+
+#ifdef ENGINE_URING
+
+#define URING_PTR(map, off)	((void *) ((char *) (map) + (off)))
+
+static int
+uring_setup(struct s_URing * u, unsigned int entries)
+{
+	struct io_uring_params p;
+	long            fd;
+
+	memset(&p, 0, sizeof(p));
+	if ((fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return (-1);
+	u->fd = (int) fd;
+	u->unsubmitted = 0;
+	u->reading = 0;
+
+	u->sqMapLen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cqMapLen > u->sqMapLen)
+			u->sqMapLen = u->cqMapLen;
+		u->cqMapLen = 0;
+	}
+#endif
+
+	u->sqMap = mmap(NULL, u->sqMapLen, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, u->fd, IORING_OFF_SQ_RING);
+	if (u->sqMap == MAP_FAILED)
+		goto fail0;
+	if (u->cqMapLen > 0) {
+		u->cqMap = mmap(NULL, u->cqMapLen, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, u->fd, IORING_OFF_CQ_RING);
+		if (u->cqMap == MAP_FAILED)
+			goto fail1;
+	} else {
+		u->cqMap = u->sqMap;
+	}
+	u->sqes = mmap(NULL, u->sqesLen, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto fail2;
+
+	u->sqTail = URING_PTR(u->sqMap, p.sq_off.tail);
+	u->sqMask = URING_PTR(u->sqMap, p.sq_off.ring_mask);
+	u->sqArray = URING_PTR(u->sqMap, p.sq_off.array);
+	u->cqHead = URING_PTR(u->cqMap, p.cq_off.head);
+	u->cqTail = URING_PTR(u->cqMap, p.cq_off.tail);
+	u->cqMask = URING_PTR(u->cqMap, p.cq_off.ring_mask);
+	u->cqes = URING_PTR(u->cqMap, p.cq_off.cqes);
+
+	return (1);
+
+fail2:
+	if (u->cqMapLen > 0)
+		munmap(u->cqMap, u->cqMapLen);
+fail1:
+	munmap(u->sqMap, u->sqMapLen);
+fail0:
+	close(u->fd);
+	return (-1);
+}
+
+static void
+uring_teardown(struct s_URing * u)
+{
+	munmap(u->sqes, u->sqesLen);
+	if (u->cqMapLen > 0)
+		munmap(u->cqMap, u->cqMapLen);
+	munmap(u->sqMap, u->sqMapLen);
+	close(u->fd);
+}
+
+/*
+ * Queue a request. It is handed to the kernel by the next poll.
+ */
+static void
+uring_queue(AIFF_EngineRef e, int i)
+{
+	struct s_URing *u = &e->ring;
+	struct s_EngineRequest *q = &e->req[i];
+	struct io_uring_sqe *sqe;
+	unsigned int    tail, idx;
+
+	q->iov.iov_base = q->raw;
+	q->iov.iov_len = q->bytes;
+
+	tail = *u->sqTail;
+	idx = tail & *u->sqMask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = q->fd;
+	sqe->off = q->offset;
+	sqe->addr = (unsigned long) &q->iov;
+	sqe->len = 1;
+	sqe->user_data = (unsigned int) i;
+	u->sqArray[idx] = idx;
+	ATOMIC_STORE(u->sqTail, tail + 1);
+
+	u->unsubmitted++;
+	u->reading++;
+}
+
+/*
+ * Submit the queued requests and, if 'wait' is set,
+ * wait for at least one completion.
+ */
+static int
+uring_enter(struct s_URing * u, int wait)
+{
+	long            n;
+
+	if (u->unsubmitted == 0 && !wait)
+		return (0);
+	n = syscall(__NR_io_uring_enter, u->fd, u->unsubmitted, wait ? 1 : 0,
+	    wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+			return (0);
+		return (-1);
+	}
+	u->unsubmitted -= (unsigned int) n;
+
+	return (1);
+}
+
+static void
+uring_reap(AIFF_EngineRef e)
+{
+	struct s_URing *u = &e->ring;
+	struct io_uring_cqe *cqe;
+	struct s_EngineRequest *q;
+	unsigned int    head, tail;
+	int             i;
+
+	head = *u->cqHead;
+	tail = ATOMIC_LOAD(u->cqTail);
+	while (head != tail) {
+		cqe = &u->cqes[head & *u->cqMask];
+		i = (int) cqe->user_data;
+		q = &e->req[i];
+		q->result = (cqe->res < 0 ? -1 : cqe->res);
+		engine_decode(q);
+		list_push(e->req, &e->doneHead, &e->doneTail, i);
+		u->reading--;
+		head++;
+	}
+	ATOMIC_STORE(u->cqHead, head);
+}
+
+static int
+uring_poll(AIFF_EngineRef e, int wait)
+{
+	struct s_URing *u = &e->ring;
+
+	for (;;) {
+		wait = wait && e->doneHead < 0 && u->reading > 0;
+		if (uring_enter(u, wait) < 0)
+			return (-1);
+		uring_reap(e);
+		if (!wait || e->doneHead >= 0)
+			return (1);
+	}
+}
+
+#endif /* ENGINE_URING */
+
+#ifdef ENGINE_THREADS
+
+static void    *
+engine_worker(void *arg)
+{
+	AIFF_EngineRef  e = arg;
+	struct s_EngineRequest *q;
+	int             i;
+
+	pthread_mutex_lock(&e->lock);
+	for (;;) {
+		while (!e->quit && e->todoHead < 0)
+			pthread_cond_wait(&e->work, &e->lock);
+		if (e->quit)
+			break;
+		i = list_pop(e->req, &e->todoHead, &e->todoTail);
+		pthread_mutex_unlock(&e->lock);
+
+		q = &e->req[i];
+		q->result = engine_pread(q->fd, q->raw, q->bytes, q->offset);
+		engine_decode(q);
+
+		pthread_mutex_lock(&e->lock);
+		list_push(e->req, &e->doneHead, &e->doneTail, i);
+		pthread_cond_signal(&e->done);
+	}
+	pthread_mutex_unlock(&e->lock);
+
+	return (NULL);
+}
+
+static void
+pool_stop(AIFF_EngineRef e, int nThreads)
+{
+	int             i;
+
+	pthread_mutex_lock(&e->lock);
+	e->quit = 1;
+	pthread_cond_broadcast(&e->work);
+	pthread_mutex_unlock(&e->lock);
+	for (i = 0; i < nThreads; i++)
+		pthread_join(e->threads[i], NULL);
+
+	free(e->threads);
+	pthread_cond_destroy(&e->done);
+	pthread_cond_destroy(&e->work);
+	pthread_mutex_destroy(&e->lock);
+}
+
+static int
+pool_start(AIFF_EngineRef e, int nThreads)
+{
+	int             i;
+
+	if (nThreads < 1)
+		nThreads = kEngineDefThreads;
+	if ((e->threads = malloc(nThreads * sizeof(pthread_t))) == NULL)
+		return (-1);
+	e->quit = 0;
+	e->todoHead = e->todoTail = -1;
+	pthread_mutex_init(&e->lock, NULL);
+	pthread_cond_init(&e->work, NULL);
+	pthread_cond_init(&e->done, NULL);
+
+	for (i = 0; i < nThreads; i++) {
+		if (pthread_create(&e->threads[i], NULL, engine_worker, e) != 0) {
+			pool_stop(e, i);
+			return (-1);
+		}
+	}
+	e->nThreads = nThreads;
+
+	return (1);
+}
+
+static void
+pool_queue(AIFF_EngineRef e, int i)
+{
+	pthread_mutex_lock(&e->lock);
+	list_push(e->req, &e->todoHead, &e->todoTail, i);
+	pthread_cond_signal(&e->work);
+	pthread_mutex_unlock(&e->lock);
+}
+
+static int
+pool_poll(AIFF_EngineRef e, AIFF_Completion * c, int maxc, int wait)
+{
+	int             n;
+
+	pthread_mutex_lock(&e->lock);
+	while (wait && e->doneHead < 0 && e->pending > 0)
+		pthread_cond_wait(&e->done, &e->lock);
+	n = engine_collect(e, c, maxc);
+	pthread_mutex_unlock(&e->lock);
+
+	return (n);
+}
+
+#endif /* ENGINE_THREADS */
+
+/*
+ * Create an engine able to hold 'depth' requests at a time.
+ * 'nThreads' is the size of the thread pool (0 for the default).
+ * 'backend' is kEngineAny, kEngineURing or kEngineThreads;
+ * kEngineAny prefers io_uring and falls back to the threads.
+ */
+AIFF_EngineRef
+AIFF_EngineCreate(int depth, int nThreads, int backend)
+{
+	AIFF_EngineRef  e;
+	int             i;
+
+	if (depth < 1 || depth > kEngineMaxDepth)
+		return (NULL);
+	if ((e = malloc(sizeof(struct s_AIFF_Engine))) == NULL)
+		return (NULL);
+	if ((e->req = malloc(depth * sizeof(struct s_EngineRequest))) == NULL) {
+		free(e);
+		return (NULL);
+	}
+	for (i = 0; i < depth; i++)
+		e->req[i].next = i + 1;
+	e->req[depth - 1].next = -1;
+	e->freeList = 0;
+	e->doneHead = e->doneTail = -1;
+	e->pending = 0;
+	e->depth = depth;
+	e->backend = kEngineAny;
+
+#ifdef ENGINE_URING
+	if (backend == kEngineAny || backend == kEngineURing) {
+		if (uring_setup(&e->ring, (unsigned int) depth) > 0)
+			e->backend = kEngineURing;
+	}
+#endif
+#ifdef ENGINE_THREADS
+	if (e->backend == kEngineAny &&
+	    (backend == kEngineAny || backend == kEngineThreads)) {
+		if (pool_start(e, nThreads) > 0)
+			e->backend = kEngineThreads;
+	}
+#else
+	(void) nThreads;
+#endif
+	if (e->backend == kEngineAny) {
+		free(e->req);
+		free(e);
+		return (NULL);
+	}
+
+	return (e);
+}
+
+/*
+ * Reads in progress are waited for; requests
+ * still queued are dropped.
+ */
+void
+AIFF_EngineDelete(AIFF_EngineRef e)
+{
+	if (e == NULL)
+		return;
+	switch (e->backend) {
+#ifdef ENGINE_URING
+	case kEngineURing:
+		while (e->ring.reading > 0) {
+			if (uring_enter(&e->ring, 1) < 0)
+				break;
+			uring_reap(e);
+		}
+		uring_teardown(&e->ring);
+		break;
+#endif
+#ifdef ENGINE_THREADS
+	case kEngineThreads:
+		pool_stop(e, e->nThreads);
+		break;
+#endif
+	default:
+		break;
+	}
+	free(e->req);
+	free(e);
+}
+
+int
+AIFF_EngineBackend(AIFF_EngineRef e)
+{
+	return (e ? e->backend : -1);
+}
+
+unsigned int
+AIFF_EnginePending(AIFF_EngineRef e)
+{
+	return (e ? e->pending : 0);
+}
+
+/*
+ * Request 'nFrames' sample frames from frame 'frame' on,
+ * to be decoded into 'samples' (which must have room for
+ * nFrames * nChannels floats and stay untouched until the
+ * request is polled). Return 1 if the request was queued,
+ * 0 if the engine is full, -1 on error.
+ */
+int
+AIFF_EngineSubmit(AIFF_EngineRef e, AIFF_Ref r, uint64_t frame,
+    unsigned int nFrames, float *samples, void *userData)
+{
+	struct s_EngineRequest *q;
+	uint64_t        start, nFr = 0;
+	int             i, fs;
+
+	if (!e || !r || !samples || nFrames < 1)
+		return (-1);
+	if (!(r->flags & F_RDONLY) || (r->flags & F_NOTSEEKABLE))
+		return (-1);
+	if (e->freeList < 0)
+		return (0);
+	if (AIFFPrepare(r) < 1)
+		return (-1);
+	if ((uint64_t) nFrames * r->nChannels > INT_MAX)
+		return (-1);
+	fs = AIFFFrameSize(r);
+
+	i = e->freeList;
+	q = &e->req[i];
+	e->freeList = q->next;
+	e->pending++;
+
+	q->ref = r;
+	q->userData = userData;
+	q->samples = samples;
+	q->fd = fileno(r->fd);
+	q->result = 0;
+	start = frame * fs;
+	/* whole frames only: 'raw' must not start before 'samples' */
+	if (frame < r->nSamples && start < r->soundLen)
+		nFr = MIN((uint64_t) nFrames, (r->soundLen - start) / fs);
+	q->bytes = (size_t) nFr * fs;
+	q->offset = r->dataOffset + start;
+	q->raw = (uint8_t *) samples +
+	    (size_t) nFr * r->nChannels * sizeof(float) - q->bytes;
+
+	if (q->bytes == 0) {
+		/* End of sound */
+		engine_complete(e, i);
+		return (1);
+	}
+	switch (e->backend) {
+#ifdef ENGINE_URING
+	case kEngineURing:
+		uring_queue(e, i);
+		break;
+#endif
+#ifdef ENGINE_THREADS
+	case kEngineThreads:
+		pool_queue(e, i);
+		break;
+#endif
+	default:
+		ASSERT(0);
+	}
+
+	return (1);
+}
+
+/*
+ * Store up to 'maxc' completed requests in 'c' and return their
+ * number. If 'wait' is set and no request has completed yet, wait
+ * for one. The number of frames decoded is 0 at the end of the
+ * sound and -1 if the read failed.
+ */
+int
+AIFF_EnginePoll(AIFF_EngineRef e, AIFF_Completion * c, int maxc, int wait)
+{
+	if (!e || !c || maxc < 1)
+		return (-1);
+
+	switch (e->backend) {
+#ifdef ENGINE_URING
+	case kEngineURing:
+		if (uring_poll(e, wait) < 0)
+			return (-1);
+		return (engine_collect(e, c, maxc));
+#endif
+#ifdef ENGINE_THREADS
+	case kEngineThreads:
+		return (pool_poll(e, c, maxc, wait));
+#endif
+	default:
+		return (-1);
+	}
+}
@@ -29,6 +29,7 @@
 #define LIBAIFF 1
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <libaiff/libaiff.h>
 #include <libaiff/endian.h>
@@ -145,6 +146,7 @@ float32_read_lpcm(AIFF_Ref r, void *buffer, size_t len)
 	size_t bytes_in;
 	size_t bytesToRead;
 	void *buf;
+	STATS_TIMER(t)
 
 	n = len >> 2;
 	len &= ~3;
@@ -156,16 +158,22 @@ float32_read_lpcm(AIFF_Ref r, void *buffer, size_t len)
 	    NULL == (buf = AIFFBufAllocate(r, kAIFFBufConv, bytesToRead)))
 		return 0;
 
+	STATS_START(t);
 	bytes_in = fread(buf, 1, bytesToRead, r->fd);
+	STATS_READ(r, bytes_in, t);
 	if (bytes_in > 0)
 		clen = (uint32_t) bytes_in;
 	else
 		clen = 0;
 	r->pos += clen;
 	
+	STATS_START(t);
 	if (r->flags & LPCM_NEED_SWAP)
 		float32_swap_samples(buf, n);
+	STATS_STOP(r, swapNanos, t);
+	STATS_START(t);
 	float32_decode(buffer, buf, n);
+	STATS_STOP(r, convertNanos, t);
 
 	return bytes_in;
 }
@@ -327,14 +335,58 @@ ieee754_read_single(uint32_t in)
 
 #endif /* ! IEEE754_NATIVE */
 
+/*
+ * Check if this host supports 32-bit IEEE floats
+ * natively and take note about it to avoid doing
+ * the test each time a buffer is to be decoded...
+ */
+static int
+float32_construct(AIFF_Ref r)
+{
+#ifndef IEEE754_NATIVE
+	if (!(r->flags & F_IEEE754_CHECKED)) {
+		r->flags |= F_IEEE754_CHECKED;
+		if (ieee754_native())
+			r->flags |= F_IEEE754_NATIVE;
+	}
+#else
+	(void) r;
+#endif
+	return (1);
+}
+
+/*
+ * Raw and decoded samples have the same size, so 'raw'
+ * may be the same memory as 'outSamples'.
+ */
+static void
+float32_decode_float32(AIFF_Ref r, void *raw, float *outSamples, int nSamples)
+{
+	if (r->flags & LPCM_NEED_SWAP)
+		float32_swap_samples(raw, nSamples);
+	
+#ifndef IEEE754_NATIVE
+	if (!(r->flags & F_IEEE754_NATIVE)) {
+		uint32_t *dwords = raw;
+		int i;
+		
+		for (i = 0; i < nSamples; ++i)
+			outSamples[i] = ieee754_read_single(dwords[i]);
+		return;
+	}
+#endif
+	if (raw != (void *) outSamples)
+		memcpy(outSamples, raw, (size_t) nSamples << 2);
+}
+
 static int
 float32_read_float32(AIFF_Ref r, float *buffer, int n)
 {
 	int nSamplesRead;
-	uint32_t clen;
 	size_t len, slen;
 	size_t bytes_in;
 	size_t bytesToRead;
+	STATS_TIMER(t)
 	
 	len = n << 2;
 	slen = r->soundLen - r->pos;
@@ -342,58 +394,18 @@ float32_read_float32(AIFF_Ref r, float *buffer, int n)
 	if (bytesToRead == 0)
 		return 0;
 	
-#ifndef IEEE754_NATIVE
-	/*
-	 * Check if this host supports 32-bit IEEE floats
-	 * natively and take note about it to avoid doing
-	 * the test each time a buffer is to be read...
-	 */
-	if (!(r->flags & F_IEEE754_CHECKED)) {
-		r->flags |= F_IEEE754_CHECKED;
-		if (ieee754_native())
-			r->flags |= F_IEEE754_NATIVE;
-	}
-	
-	if (r->flags & F_IEEE754_NATIVE) {
-#endif
-		bytes_in = fread((void *) buffer, 1, bytesToRead, r->fd);
-		
-		if (bytes_in > 0) {
-			nSamplesRead = (int) bytes_in >> 2;
-			if (r->flags & LPCM_NEED_SWAP)
-				float32_swap_samples((void *) buffer, nSamplesRead);
-		} else {
-			nSamplesRead = 0;
-		}
-		
-#ifndef IEEE754_NATIVE
-	} else {
-		void	*buf = AIFFBufAllocate(r, kAIFFBufConv, bytesToRead);
-
-		if (buf == NULL)
-			return 0;
-		
-		bytes_in = fread(buf, 1, bytesToRead, r->fd);
-		if (bytes_in > 0) {
-			uint32_t *dwords = buf;
-			
-			nSamplesRead = (int) bytes_in >> 2;
-			if (r->flags & LPCM_NEED_SWAP)
-				float32_swap_samples(dwords, nSamplesRead);
-			
-			while (nSamplesRead-- > 0)
-				buffer[nSamplesRead] = ieee754_read_single(dwords[nSamplesRead]);
-		} else {
-			nSamplesRead = 0;
-		}
-	}
-#endif
+	STATS_START(t);
+	bytes_in = fread((void *) buffer, 1, bytesToRead, r->fd);
+	STATS_READ(r, bytes_in, t);
+	if (bytes_in == 0)
+		return 0;
+	r->pos += (uint32_t) bytes_in;
 	
-	if (bytes_in > 0)
-		clen = (uint32_t) bytes_in;
-	else
-		clen = 0;
-	r->pos += clen;
+	nSamplesRead = (int) bytes_in >> 2;
+	/* swapping is most of the decoding */
+	STATS_START(t);
+	float32_decode_float32(r, buffer, buffer, nSamplesRead);
+	STATS_STOP(r, swapNanos, t);
 	
 	return nSamplesRead;
 }
@@ -401,9 +413,10 @@ float32_read_float32(AIFF_Ref r, float *buffer, int n)
 
 struct codec float32 = {
 	AUDIO_FORMAT_FL32,
-	NULL,
+	float32_construct,
 	float32_read_lpcm,
 	float32_read_float32,
+	float32_decode_float32,
         NULL,
 	float32_seek,
 	NULL
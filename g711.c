@@ -156,6 +156,23 @@ g711_alaw_create(AIFF_Ref r)
 		return -1;
 }
 
+/*
+ * Fill 'table' with the linear value of every byte
+ * of encoding 'fmt' (mu-Law or A-Law).
+ */
+void
+g711_table(IFFType fmt, int16_t *table)
+{
+	int             i;
+
+	for (i = 0; i < 256; ++i) {
+		if (fmt == AUDIO_FORMAT_ULAW || fmt == AUDIO_FORMAT_ulaw)
+			table[i] = ulawdec(i);
+		else
+			table[i] = alawdec(i);
+	}
+}
+
 static void
 g711_delete(AIFF_Ref r)
 {
@@ -169,6 +186,7 @@ g711_read_lpcm(AIFF_Ref r, void *buffer, size_t len)
 	uint8_t        *bytes;
 	int16_t        *samples, *table = r->pdata;
 	void           *buf;
+	STATS_TIMER(t)
 
 	/* length must be even */
 	len &= ~1;
@@ -183,18 +201,22 @@ g711_read_lpcm(AIFF_Ref r, void *buffer, size_t len)
 	if (NULL == buf)
 		return 0;
 	
+	STATS_START(t);
 	bytesRead = fread(buf, 1, bytesToRead, r->fd);
+	STATS_READ(r, bytesRead, t);
 	if (bytesRead > 0) {
 		r->pos += bytesRead;
 	} else {
 		return 0;
 	}
 
+	STATS_START(t);
 	bytes = buf;
 	samples = buffer;
 	for (i = 0; i < bytesRead; ++i) {
 		samples[i] = table[bytes[i]];
 	}
+	STATS_STOP(r, convertNanos, t);
 
 	return (bytesRead << 1);
 }
@@ -218,34 +240,48 @@ g711_seek(AIFF_Ref r, uint64_t pos)
 	return 1;
 }
 
+static void
+g711_decode_float32(AIFF_Ref r, void *raw, float *outSamples, int nSamples)
+{
+	int             i;
+	uint8_t        *bytes = raw;
+	int16_t        *table = r->pdata;
+
+	for (i = 0; i < nSamples; ++i) {
+		outSamples[i] = ldexp(table[bytes[i]], -15);
+	}
+}
+
+/*
+ * The encoded bytes are read into the tail of the caller's buffer
+ * and expanded in place (byte i always lies after float i).
+ */
 static int
 g711_read_float32(AIFF_Ref r, float *buffer, int nFrames)
 {
-	size_t          n = nFrames, i, rem, bytesToRead, bytesRead;
+	size_t          n = nFrames, rem, bytesToRead, bytesRead;
 	uint8_t        *bytes;
-	int16_t        *table = r->pdata;
-	void           *buf;
+	STATS_TIMER(t)
 
 	rem = r->soundLen - r->pos;
 	bytesToRead = MIN(n, rem);
 	if (bytesToRead == 0)
 		return 0;
 
-	buf = AIFFBufAllocate(r, kAIFFBufConv, bytesToRead);
-	if (NULL == buf)
-		return 0;
+	bytes = (uint8_t *) buffer + bytesToRead * (sizeof(float) - 1);
 	
-	bytesRead = fread(buf, 1, bytesToRead, r->fd);
+	STATS_START(t);
+	bytesRead = fread(bytes, 1, bytesToRead, r->fd);
+	STATS_READ(r, bytesRead, t);
 	if (bytesRead > 0) {
 		r->pos += bytesRead;
 	} else {
 		return 0;
 	}
 
-	bytes = buf;
-	for (i = 0; i < bytesRead; ++i) {
-		buffer[i] = ldexp(table[bytes[i]], -15);
-	}
+	STATS_START(t);
+	g711_decode_float32(r, bytes, buffer, (int) bytesRead);
+	STATS_STOP(r, convertNanos, t);
 
 	return bytesRead;       /* = framesRead */
 }
@@ -257,6 +293,7 @@ g711_write_lpcm(AIFF_Ref w, void *inptr, size_t ilen, int readOnlyBuf)
         int16_t  *inb;
         uint8_t (*f)(int16_t);
         int       i, n;
+        STATS_TIMER(t)
         
         if (2 != w->segmentSize)
                 return (-1);
@@ -278,12 +315,17 @@ g711_write_lpcm(AIFF_Ref w, void *inptr, size_t ilen, int readOnlyBuf)
                 ASSERT(0);
         }
         
+        STATS_START(t);
         for (i = 0; i < n; i++) {
                 outb[i] = (*f)(inb[i]);
         }
+        STATS_STOP(w, convertNanos, t);
+        checksum_update(w, outb, n);
+        STATS_START(t);
         if (fwrite(outb, 1, n, w->fd) != (size_t)n) {
                 return (-1);
         }
+        STATS_WRITE(w, n, t);
         
         w->nSamples += n;
         w->sampleBytes += n;
@@ -297,6 +339,7 @@ struct codec  ulaw = {
 	g711_ulaw_create,
 	g711_read_lpcm,
 	g711_read_float32,
+	g711_decode_float32,
         g711_write_lpcm,
 	g711_seek,
 	g711_delete
@@ -307,6 +350,7 @@ struct codec  alaw = {
 	g711_alaw_create,
 	g711_read_lpcm,
 	g711_read_float32,
+	g711_decode_float32,
         g711_write_lpcm,
 	g711_seek,
 	g711_delete
@@ -34,19 +34,96 @@
 #include <libaiff/endian.h>
 #include "private.h"
 
+static int find_chunk(IFFType, AIFF_Ref, uint32_t *);
+
+/*
+ * Build the chunk table of a seekable file, walking the chunk
+ * headers once. Return 1, or -1 if out of memory.
+ */
+int 
+index_iff_chunks(AIFF_Ref r)
+{
+	IFFChunk chk;
+	IFFChunkEntry *t;
+	int max = 0;
+	long of = 12;
+
+	ASSERT(sizeof(IFFChunk) == 8);
+	r->chunks = NULL;
+	r->nChunks = 0;
+
+	for (;;) {
+		STATS_ADD(r, seeks, 1);
+		STATS_ADD(r, chunkScans, 1);
+		if (fseek(r->fd, of, SEEK_SET) < 0 ||
+		    fread(&chk, 1, 8, r->fd) < 8)
+			break;
+		if (r->nChunks == max) {
+			max = (max ? 2 * max : 16);
+			t = realloc(r->chunks, (size_t) max * sizeof(IFFChunkEntry));
+			if (t == NULL) {
+				free(r->chunks);
+				r->chunks = NULL;
+				return (-1);
+			}
+			r->chunks = t;
+		}
+		t = &r->chunks[r->nChunks++];
+		t->id = ARRANGE_BE32(chk.id);
+		t->len = ARRANGE_BE32(chk.len);
+		t->offset = (uint64_t) of + 8;
+
+		/*
+		 * In IFF files chunk start offsets must be even.
+		 */
+		of += 8 + (long) t->len + (long) (t->len & 1);
+		if (of < 0)
+			break;
+	}
+
+	return (1);
+}
+
 /*
  * Find an IFF chunk. Return 1 (found) or 0 (not found / error).
  * If found, update 'length' to be the chunk length.
  */
 int 
 find_iff_chunk(IFFType chunk, AIFF_Ref r, uint32_t * length)
+{
+	int res;
+
+	TRACE_BEGIN(r, kTraceFindChunk);
+	res = find_chunk(chunk, r, length);
+	TRACE_END(r, kTraceFindChunk, res ? *length : 0);
+
+	return (res);
+}
+
+static int 
+find_chunk(IFFType chunk, AIFF_Ref r, uint32_t * length)
 {
 	union cio {
 		uint8_t buf[8];
 		IFFChunk chk;
 	} d;
+	int i;
 	
 	ASSERT(sizeof(IFFChunk) == 8);
+
+	if (r->chunks) {
+		for (i = 0; i < r->nChunks; i++) {
+			if (r->chunks[i].id == chunk) {
+				STATS_ADD(r, seeks, 1);
+				if (fseek(r->fd, (long) r->chunks[i].offset,
+				    SEEK_SET) < 0)
+					return (0);
+				*length = r->chunks[i].len;
+				return (1);
+			}
+		}
+		return (0);
+	}
 	chunk = ARRANGE_BE32(chunk);
 
 	/*
@@ -75,6 +152,7 @@ find_iff_chunk(IFFType chunk, AIFF_Ref r, uint32_t * length)
 	 * Navigate through the file to find the chunk
 	 */
 	for (;;) {
+		STATS_ADD(r, chunkScans, 1);
 		if (fread(d.buf, 1, 8, r->fd) < 8)
 			return (0);
 		
@@ -117,6 +195,146 @@ find_iff_chunk(IFFType chunk, AIFF_Ref r, uint32_t * length)
 	return (0);
 }
 
+static int
+put_iff_header(FILE *fd, long offset, IFFType id, uint32_t len)
+{
+	IFFChunk chk;
+
+	chk.id = ARRANGE_BE32(id);
+	chk.len = ARRANGE_BE32(len);
+	if (fseek(fd, offset, SEEK_SET) < 0 ||
+	    fwrite(&chk, 1, 8, fd) != 8)
+		return (-1);
+	return (1);
+}
+
+/*
+ * Join runs of adjacent filler chunks into one,
+ * so the space they free can be reused.
+ */
+static int
+merge_iff_fillers(AIFF_Ref r)
+{
+	IFFChunkEntry *c;
+	uint64_t size;
+	int i, j, merged = 0;
+
+	for (i = 0; i < r->nChunks; i = j) {
+		c = &r->chunks[i];
+		size = c->len + (c->len & 1);
+		for (j = i + 1; j < r->nChunks && c->id == IFF_FILLER &&
+		    r->chunks[j].id == IFF_FILLER; j++)
+			size += 8 + r->chunks[j].len + (r->chunks[j].len & 1);
+		if (j == i + 1)
+			continue;
+		if (size > 0xFFFFFFFFU) {
+			j = i + 1;
+			continue;
+		}
+		if (put_iff_header(r->fd, (long) c->offset - 8,
+		    IFF_FILLER, (uint32_t) size) < 0)
+			return (-1);
+		merged = 1;
+	}
+	if (!merged)
+		return (1);
+	if (fflush(r->fd) != 0)
+		return (-1);
+
+	free(r->chunks);
+	return (index_iff_chunks(r));
+}
+
+/*
+ * Replace the chunk 'id' of a file open for update with 'chunk' (a
+ * whole chunk, header included, whose length is 'len'), or remove it
+ * if 'chunk' is NULL. The new chunk goes where the old one was, or
+ * into a filler chunk, if it fits; else it is appended to the FORM.
+ * The space left over, and the old chunk if it moved, become filler
+ * chunks. Only the chunk and the FORM length are written.
+ * Return 1, or -1 on error.
+ */
+int 
+replace_iff_chunk(AIFF_Ref r, IFFType id, const uint8_t *chunk, uint32_t len)
+{
+	IFFChunkEntry *c, *old = NULL, *slot = NULL;
+	uint32_t formLen;
+	uint64_t need, size, end = 12;
+	long at;
+	int i;
+
+	ASSERT(r->chunks != NULL);
+	need = 8 + (uint64_t) len + (len & 1);
+
+	/*
+	 * The chunks found by index_iff_chunks are what readers see,
+	 * whatever the FORM length says (it is 4 on unfinished files).
+	 */
+	for (i = 0; i < r->nChunks; i++) {
+		c = &r->chunks[i];
+		if (c->id == id && !old)
+			old = c;
+		end = c->offset + c->len + (c->len & 1);
+	}
+	if (chunk) {
+		/* a slot fits if nothing is left or a filler chunk fits in the rest */
+		for (i = -1; i < r->nChunks && !slot; i++) {
+			c = (i < 0 ? old : &r->chunks[i]);
+			if (!c || (i >= 0 && c->id != IFF_FILLER))
+				continue;
+			size = 8 + (uint64_t) c->len + (c->len & 1);
+			if (size == need || size >= need + 8)
+				slot = c;
+		}
+	}
+
+	if (chunk && slot) {
+		size = 8 + (uint64_t) slot->len + (slot->len & 1);
+		at = (long) slot->offset - 8;
+		if (fseek(r->fd, at, SEEK_SET) < 0 ||
+		    fwrite(chunk, 1, (size_t) need, r->fd) != need)
+			return (-1);
+		if (size > need && put_iff_header(r->fd, at + (long) need,
+		    IFF_FILLER, (uint32_t) (size - need - 8)) < 0)
+			return (-1);
+	} else if (chunk) {
+		/*
+		 * Append; if the old chunk is the last one
+		 * and the new one is larger, grow it in place.
+		 */
+		at = (long) end;
+		if (old && old->offset + old->len + (old->len & 1) == end &&
+		    need > 8 + (uint64_t) old->len + (old->len & 1)) {
+			at = (long) old->offset - 8;
+			old = NULL;
+		}
+		if ((uint64_t) at + need - 8 > 0xFFFFFFFFU)
+			return (-1);
+		if (fseek(r->fd, at, SEEK_SET) < 0 ||
+		    fwrite(chunk, 1, (size_t) need, r->fd) != need)
+			return (-1);
+		formLen = (uint32_t) ((uint64_t) at + need - 8);
+		formLen = ARRANGE_BE32(formLen);
+		if (fseek(r->fd, 4, SEEK_SET) < 0 ||
+		    fwrite(&formLen, 1, 4, r->fd) != 4)
+			return (-1);
+	}
+	if (old && old != slot) {
+		if (put_iff_header(r->fd, (long) old->offset - 8,
+		    IFF_FILLER, old->len) < 0)
+			return (-1);
+	}
+	if (fflush(r->fd) != 0)
+		return (-1);
+
+	/* re-read the chunk table */
+	free(r->chunks);
+	if (index_iff_chunks(r) < 1)
+		return (-1);
+
+	return (merge_iff_fillers(r));
+}
+
 char *
 get_iff_attribute(AIFF_Ref r, IFFType attrib)
 {
@@ -44,20 +44,30 @@ static struct codec* codecs[] = {
 
 static AIFF_Ref AIFF_ReadOpen (const char *, int);
 static AIFF_Ref AIFF_WriteOpen (const char *, int);
-static void AIFF_ReadClose (AIFF_Ref);
+static AIFF_Ref AIFF_AppendOpen (const char *, int);
+static int AIFF_ReadClose (AIFF_Ref);
 static int AIFF_WriteClose (AIFF_Ref);
 static int DoWriteSamples (AIFF_Ref, void *, size_t, int);
 static int Prepare (AIFF_Ref);
 static void Unprepare (AIFF_Ref);
 static struct codec* FindCodec (IFFType);
+static int FrameSize (AIFF_Ref);
+static void DropMarkerIndex (AIFF_Ref);
+static void FreeQueuedMarkers (AIFF_Ref);
 
 AIFF_Ref
 AIFF_OpenFile(const char *file, int flags)
 {
 	AIFF_Ref ref = NULL;
 	
-	if (flags & F_RDONLY) {
+	if (flags & F_RDWR) {
+		/* an update reference is a read reference that can edit */
+		if (!(flags & F_NOTSEEKABLE))
+			ref = AIFF_ReadOpen(file, (flags & ~F_WRONLY) | F_RDONLY);
+	} else if (flags & F_RDONLY) {
 		ref = AIFF_ReadOpen(file, flags);
+	} else if ((flags & F_WRONLY) && (flags & F_APPEND)) {
+		ref = AIFF_AppendOpen(file, flags);
 	} else if (flags & F_WRONLY) {
 		ref = AIFF_WriteOpen(file, flags);
 	}
@@ -73,8 +83,7 @@ AIFF_CloseFile(AIFF_Ref ref)
 	if (!ref)
 		return -1;
 	if (ref->flags & F_RDONLY) {
-		AIFF_ReadClose(ref);
-		r = 1;
+		r = AIFF_ReadClose(ref);
 	} else if (ref->flags & F_WRONLY) {
 		r = AIFF_WriteClose(ref);
 	} else {
@@ -86,20 +95,66 @@ AIFF_CloseFile(AIFF_Ref ref)
 
 static AIFF_Ref 
 AIFF_ReadOpen(const char *file, int flags)
+{
+	FILE *fd;
+	AIFF_Ref r = NULL;
+
+	TRACE_BEGIN(NULL, kTraceOpen);
+	fd = fopen(file, (flags & F_RDWR) ? "r+b" : "rb");
+	if (fd != NULL)
+		r = AIFFReadOpenStream(fd, flags, NULL);
+	TRACE_END(r, kTraceOpen, 0);
+
+	return r;
+}
+
+/*
+ * Make a read reference of the stream 'fd', which is closed on error.
+ * If 'idx' is not NULL, the header is not parsed but taken from it,
+ * and its chunk table is handed over to the new reference.
+ */
+AIFF_Ref
+AIFFReadOpenStream(FILE *fd, int flags, AIFFIndex *idx)
 {
 	AIFF_Ref r;
 	IFFHeader hdr;
 
 	r = malloc(kAIFFRecSize);
 	if (!r) {
+		if (idx)
+			free(idx->chunks);
+		fclose(fd);
 		return NULL;
 	}
-	r->fd = fopen(file, "rb");
-	if (r->fd == NULL) {
-		free(r);
-		return NULL;
-	}
+	STATS_RESET(r);
+	r->fd = fd;
 	r->flags = F_RDONLY | flags;
+	r->chunks = NULL;
+	r->nChunks = 0;
+	r->markerIndex = NULL;
+	r->trailer = NULL;
+	r->trailerLen = 0;
+	r->checkpoint = NULL;
+	r->checksum = NULL;
+	r->resampler = NULL;
+	r->dither = NULL;
+	r->queued = NULL;
+	r->nQueued = r->maxQueued = 0;
+
+	if (idx) {
+		r->format = idx->format;
+		r->nSamples = idx->common.nSamples;
+		r->nChannels = idx->common.nChannels;
+		r->samplingRate = idx->common.samplingRate;
+		r->bitsPerSample = idx->common.bitsPerSample;
+		r->segmentSize = idx->common.segmentSize;
+		r->audioFormat = idx->common.audioFormat;
+		r->flags |= idx->common.flags;
+		r->chunks = idx->chunks;
+		r->nChunks = idx->nChunks;
+		goto opened;
+	}
+
 	if (fread(&hdr, 1, sizeof(hdr), r->fd) != sizeof(hdr)) {
 		fclose(r->fd);
 		free(r);
@@ -126,7 +181,17 @@ AIFF_ReadOpen(const char *file, int flags)
 			return NULL;
 		}
 
+		/*
+		 * Walk the chunks once; the later
+		 * lookups go straight to them.
+		 */
+		if (!(r->flags & F_NOTSEEKABLE) && index_iff_chunks(r) < 0) {
+			fclose(r->fd);
+			free(r);
+			return NULL;
+		}
 		if (init_aifx(r) < 1) {
+			free(r->chunks);
 			fclose(r->fd);
 			free(r);
 			return NULL;
@@ -138,7 +203,10 @@ AIFF_ReadOpen(const char *file, int flags)
 		return NULL;
 	}
 
+opened:
 	r->stat = 0;
+	r->prefetch = NULL;
+	r->spool = NULL;
 
 	memset(r->buf, 0, sizeof(r->buf));
 
@@ -148,7 +216,7 @@ AIFF_ReadOpen(const char *file, int flags)
 char *
 AIFF_GetAttribute(AIFF_Ref r, IFFType attrib)
 {
-	if (!r || !(r->flags & F_RDONLY))
+	if (!r || !(r->flags & F_RDONLY) || r->prefetch)
 		return NULL;
 	Unprepare(r);
 	
@@ -167,8 +235,10 @@ AIFF_GetAttribute(AIFF_Ref r, IFFType attrib)
 int 
 AIFF_ReadMarker(AIFF_Ref r, int *id, uint64_t * pos, char **name)
 {
-	if (!r || !(r->flags & F_RDONLY))
+	if (!r || !(r->flags & F_RDONLY) || r->prefetch)
 		return -1;
+	if (r->stat != 2)
+		Unprepare(r);
 	
 	switch (r->format) {
 	case AIFF_TYPE_AIFF:
@@ -182,10 +252,301 @@ AIFF_ReadMarker(AIFF_Ref r, int *id, uint64_t * pos, char **name)
 	return 0;
 }
 
+/*
+ * Get all the markers of the file, sorted by position,
+ * in one block to be freed with AIFF_FreeMarkers.
+ */
+int
+AIFF_ReadAllMarkers(AIFF_Ref r, AIFF_MarkerList ** list)
+{
+	if (!r || !list || !(r->flags & F_RDONLY) || r->prefetch)
+		return -1;
+	Unprepare(r);
+
+	switch (r->format) {
+	case AIFF_TYPE_AIFF:
+	case AIFF_TYPE_AIFC:
+		return read_aifx_markers(r, list);
+	default:
+		*list = NULL;
+		return 0;
+	}
+}
+
+void
+AIFF_FreeMarkers(AIFF_MarkerList * list)
+{
+	free(list);
+}
+
+/*
+ * Get all the comments of the file, in file order,
+ * in one block to be freed with AIFF_FreeComments.
+ */
+int
+AIFF_ReadAllComments(AIFF_Ref r, AIFF_CommentList ** list)
+{
+	if (!r || !list || !(r->flags & F_RDONLY) || r->prefetch)
+		return -1;
+	Unprepare(r);
+
+	switch (r->format) {
+	case AIFF_TYPE_AIFF:
+	case AIFF_TYPE_AIFC:
+		return read_aifx_comments(r, list);
+	default:
+		*list = NULL;
+		return 0;
+	}
+}
+
+void
+AIFF_FreeComments(AIFF_CommentList * list)
+{
+	free(list);
+}
+
+static void
+DropMarkerIndex(AIFF_Ref r)
+{
+	if (r->markerIndex) {
+		AIFF_FreeMarkers(r->markerIndex->list);
+		AIFF_FreeComments(r->markerIndex->comments);
+		free(r->markerIndex);
+		r->markerIndex = NULL;
+	}
+}
+
+/*
+ * Order comments by marker, keeping the file order
+ * (that of the texts in the block) within a marker.
+ */
+static int
+CommentCompare(const void *a, const void *b)
+{
+	const AIFF_Comment *x = a;
+	const AIFF_Comment *y = b;
+
+	if (x->marker != y->marker)
+		return (x->marker < y->marker ? -1 : 1);
+	if (x->text != y->text)
+		return (x->text < y->text ? -1 : 1);
+	return 0;
+}
+
+/*
+ * Build the marker index of a read reference, keeping
+ * the sample read position. The comments are read along,
+ * to be looked up by marker.
+ */
+static struct s_AIFF_MarkerIndex *
+MarkerIndex(AIFF_Ref r)
+{
+	struct s_AIFF_MarkerIndex *x;
+	AIFF_MarkerList *l;
+	AIFF_CommentList *c;
+	uint64_t frame = 0;
+	int prepared, maxId = 0;
+	size_t i;
+
+	if (!r || !(r->flags & F_RDONLY) || r->prefetch)
+		return NULL;
+	if (r->markerIndex)
+		return r->markerIndex;
+
+	prepared = (r->stat == 1);
+	if (prepared)
+		frame = r->pos / FrameSize(r);
+	if (AIFF_ReadAllMarkers(r, &l) < 0)
+		return NULL;
+	if (AIFF_ReadAllComments(r, &c) < 0) {
+		AIFF_FreeMarkers(l);
+		return NULL;
+	}
+	if (c)
+		qsort(c->comments, c->nComments, sizeof(AIFF_Comment), CommentCompare);
+	if (l) {
+		for (i = 0; i < l->nMarkers; ++i) {
+			if (l->markers[i].id > maxId)
+				maxId = l->markers[i].id;
+		}
+	}
+	x = malloc(sizeof(struct s_AIFF_MarkerIndex) + (maxId + 1) * sizeof(int));
+	if (!x) {
+		AIFF_FreeMarkers(l);
+		AIFF_FreeComments(c);
+		return NULL;
+	}
+	x->list = l;
+	x->comments = c;
+	x->markers = (l ? l->markers : NULL);
+	x->nMarkers = (l ? l->nMarkers : 0);
+	x->byId = (int *) (x + 1);
+	x->maxId = maxId;
+	for (i = 0; i <= (size_t) maxId; ++i)
+		x->byId[i] = -1;
+	for (i = x->nMarkers; i-- > 0;)
+		x->byId[x->markers[i].id] = (int) i;
+	r->markerIndex = x;
+
+	if (prepared && Prepare(r) > 0)
+		(void) r->codec->seek(r, frame);
+
+	return x;
+}
+
+/*
+ * Get the comments attached to the marker 'id' (0 for the comments
+ * attached to no marker), in file order. Store their number in 'n'.
+ */
+const AIFF_Comment *
+AIFF_MarkerComments(AIFF_Ref r, MarkerId id, size_t * n)
+{
+	struct s_AIFF_MarkerIndex *x;
+	AIFF_Comment *cm;
+	size_t lo, hi, mid, first;
+
+	if (n)
+		*n = 0;
+	if ((x = MarkerIndex(r)) == NULL || x->comments == NULL)
+		return NULL;
+
+	cm = x->comments->comments;
+	lo = 0;
+	hi = x->comments->nComments;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (cm[mid].marker < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = lo;
+	for (hi = x->comments->nComments; lo < hi && cm[lo].marker == id; ++lo)
+		continue;
+	if (lo == first)
+		return NULL;
+	if (n)
+		*n = lo - first;
+	return &cm[first];
+}
+
+/*
+ * Number of markers at or before 'frame'.
+ */
+static size_t
+MarkerUpperBound(struct s_AIFF_MarkerIndex *x, uint64_t frame)
+{
+	size_t lo = 0, hi = x->nMarkers, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (x->markers[mid].position <= frame)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+const AIFF_Marker *
+AIFF_FindMarker(AIFF_Ref r, MarkerId id)
+{
+	struct s_AIFF_MarkerIndex *x;
+
+	if ((x = MarkerIndex(r)) == NULL || id > x->maxId || x->byId[id] < 0)
+		return NULL;
+	return &x->markers[x->byId[id]];
+}
+
+/*
+ * The last marker at or before 'frame'.
+ */
+const AIFF_Marker *
+AIFF_MarkerBefore(AIFF_Ref r, uint64_t frame)
+{
+	struct s_AIFF_MarkerIndex *x;
+	size_t i;
+
+	if ((x = MarkerIndex(r)) == NULL || (i = MarkerUpperBound(x, frame)) == 0)
+		return NULL;
+	return &x->markers[i - 1];
+}
+
+/*
+ * The first marker after 'frame'.
+ */
+const AIFF_Marker *
+AIFF_MarkerAfter(AIFF_Ref r, uint64_t frame)
+{
+	struct s_AIFF_MarkerIndex *x;
+	size_t i;
+
+	if ((x = MarkerIndex(r)) == NULL || (i = MarkerUpperBound(x, frame)) == x->nMarkers)
+		return NULL;
+	return &x->markers[i];
+}
+
+/*
+ * Region 'i' goes from marker 'i' to the next
+ * marker, or to the end of the sound.
+ */
+static void
+MarkerRegion(AIFF_Ref r, struct s_AIFF_MarkerIndex *x, size_t i, AIFF_Region * rg)
+{
+	rg->start = x->markers[i].position;
+	if (i + 1 < x->nMarkers)
+		rg->end = x->markers[i + 1].position;
+	else
+		rg->end = (r->nSamples > rg->start ? r->nSamples : rg->start);
+	rg->name = x->markers[i].name;
+	rg->id = x->markers[i].id;
+	rg->next = i + 1;
+}
+
+/*
+ * Get the region holding 'frame'. Return 1, 0 if 'frame'
+ * is in no region, or -1 on error.
+ */
+int
+AIFF_GetRegion(AIFF_Ref r, uint64_t frame, AIFF_Region * rg)
+{
+	struct s_AIFF_MarkerIndex *x;
+	size_t i;
+
+	if (!rg || (x = MarkerIndex(r)) == NULL)
+		return -1;
+	if ((i = MarkerUpperBound(x, frame)) == 0)
+		return 0;
+	MarkerRegion(r, x, i - 1, rg);
+	if (frame >= rg->end)
+		return 0;
+	return 1;
+}
+
+/*
+ * Get the region 'rg->next' (0 for the first one) and seek to
+ * its start. Return 1, 0 if there are no more regions, or -1 on error.
+ */
+int
+AIFF_NextRegion(AIFF_Ref r, AIFF_Region * rg)
+{
+	struct s_AIFF_MarkerIndex *x;
+
+	if (!rg || (x = MarkerIndex(r)) == NULL)
+		return -1;
+	if (rg->next >= x->nMarkers)
+		return 0;
+	MarkerRegion(r, x, rg->next, rg);
+	if (AIFF_Seek(r, rg->start) < 0)
+		return -1;
+	return 1;
+}
+
 int 
 AIFF_GetInstrumentData(AIFF_Ref r, Instrument * i)
 {
-	if (!r || !(r->flags & F_RDONLY))
+	if (!r || !(r->flags & F_RDONLY) || r->prefetch)
 		return (-1);
 	Unprepare(r);
 	
@@ -225,9 +586,10 @@ static int
 Prepare (AIFF_Ref r)
 {
 	int res;
-	struct codec *dec;
+	struct codec *dec = NULL;
 	
 	if (r->stat != 1) {
+		TRACE_BEGIN(r, kTracePrepare);
 		switch (r->format) {
 		case AIFF_TYPE_AIFF:
 		case AIFF_TYPE_AIFC:
@@ -236,14 +598,13 @@ Prepare (AIFF_Ref r)
 		default:
 			res = -1;
 		}
+		if (res > 0 && (dec = FindCodec(r->audioFormat)) == NULL)
+			res = -1;
+		if (res > 0 && dec->construct)
+			res = dec->construct(r);
+		TRACE_END(r, kTracePrepare, 0);
 		if (res < 1)
 			return res;
-		if ((dec = FindCodec(r->audioFormat)) == NULL)
-			return -1;
-		if (dec->construct) {
-			if ((res = dec->construct(r)) < 1)
-				return res;
-		}
 
 		r->codec = dec;
 		r->stat = 1;
@@ -277,51 +638,178 @@ FindCodec (IFFType fmt)
 	return NULL;
 }
 
+/*
+ * Size in bytes of a sample frame as stored on the file.
+ */
+static int
+FrameSize (AIFF_Ref r)
+{
+	switch (r->audioFormat) {
+	case AUDIO_FORMAT_ULAW:
+	case AUDIO_FORMAT_ALAW:
+		return r->nChannels;
+	default:
+		return r->nChannels * r->segmentSize;
+	}
+}
+
 size_t 
 AIFF_ReadSamples(AIFF_Ref r, void *buffer, size_t len)
 {
 	struct codec *dec;
+	uint64_t pos;
+	size_t n;
 	
-	if (!r || !(r->flags & F_RDONLY) || Prepare(r) < 1)
+	if (!r || !(r->flags & F_RDONLY) || r->prefetch || r->resampler ||
+	    Prepare(r) < 1)
 		return 0;
 	dec = r->codec;
 	
-	return dec->read_lpcm(r, buffer, len);
+	pos = r->pos;
+	TRACE_BEGIN(r, kTraceReadLPCM);
+	n = dec->read_lpcm(r, buffer, len);
+	TRACE_END(r, kTraceReadLPCM, r->pos - pos);
+
+	return n;
 }
 
 int
 AIFF_ReadSamplesFloat(AIFF_Ref r, float *buffer, int nSamplePoints)
 {
-	int res;
-	struct codec *dec;
-	
 	if (!r || !(r->flags & F_RDONLY))
 		return -1;
 	if (nSamplePoints % (r->nChannels) != 0)
 		return 0;
+	if (r->resampler)
+		return resample_read(r, buffer, nSamplePoints);
+
+	return AIFFReadFloat(r, buffer, nSamplePoints);
+}
+
+/*
+ * Read samples as stored on the file (at its sampling rate),
+ * for AIFF_ReadSamplesFloat and the resampler.
+ */
+int
+AIFFReadFloat(AIFF_Ref r, float *buffer, int nSamplePoints)
+{
+	int res;
+	struct codec *dec;
+	uint64_t pos;
+	
+	if (r->prefetch)
+		return prefetch_read_float32(r, buffer, nSamplePoints);
 	if ((res = Prepare(r)) < 1)
 		return res;
 	dec = r->codec;
 	
-	return dec->read_float32(r, buffer, nSamplePoints);
+	pos = r->pos;
+	TRACE_BEGIN(r, kTraceReadFloat);
+	res = dec->read_float32(r, buffer, nSamplePoints);
+	TRACE_END(r, kTraceReadFloat, r->pos - pos);
+
+	return res;
 }
 
 int 
 AIFF_Seek(AIFF_Ref r, uint64_t framePos)
+{
+	if (!r || !(r->flags & F_RDONLY))
+		return -1;
+	if (r->flags & F_NOTSEEKABLE)
+		return -1;
+	if (r->resampler)
+		return resample_seek(r, framePos);
+
+	return AIFFSeek(r, framePos);
+}
+
+/*
+ * Seek to sample frame 'framePos' of the file
+ * (at its sampling rate).
+ */
+int
+AIFFSeek(AIFF_Ref r, uint64_t framePos)
 {
 	int res = 0;
 	struct codec *dec;
+	STATS_TIMER(t)
+
+	if (r->prefetch)
+		prefetch_pause(r);
+	Unprepare(r);
+	if ((res = Prepare(r)) < 1)
+		return res;
+	dec = r->codec;
+
+	TRACE_BEGIN(r, kTraceSeek);
+	STATS_START(t);
+	res = dec->seek(r, framePos);
+	STATS_STOP(r, ioNanos, t);
+	TRACE_END(r, kTraceSeek, 0);
+	STATS_ADD(r, seeks, 1);
+	if (res < 1)
+		framePos = 0;	/* the codec did not move */
+	if (r->prefetch && prefetch_resume(r, framePos) < 1)
+		return -1;
+
+	return res;
+}
+
+int
+AIFF_StartPrefetch(AIFF_Ref r, int nBlocks, int blockFrames)
+{
+	int res;
+
+	if (!r || !(r->flags & F_RDONLY))
+		return -1;
+	if (r->prefetch)
+		return 0;
+	if ((res = Prepare(r)) < 1)
+		return res;
+
+	return prefetch_start(r, nBlocks, blockFrames, r->pos / FrameSize(r));
+}
+
+int
+AIFF_StopPrefetch(AIFF_Ref r)
+{
+	uint64_t framePos;
 
 	if (!r || !(r->flags & F_RDONLY))
 		return -1;
+	if (!r->prefetch)
+		return 0;
+	prefetch_destroy(r, &framePos);
+
+	/*
+	 * The worker has read ahead of the reader: go back
+	 * to where the reader was, if we can.
+	 */
 	if (r->flags & F_NOTSEEKABLE)
+		return 1;
+	return AIFFSeek(r, framePos);
+}
+
+uint64_t
+AIFF_PrefetchUnderruns(AIFF_Ref r)
+{
+	if (!r || !r->prefetch)
+		return 0;
+	return prefetch_underruns(r);
+}
+
+int
+AIFF_RingFill(AIFF_Ref r, AIFF_RingRef q, unsigned int nFrames)
+{
+	int res;
+
+	if (!r || !(r->flags & F_RDONLY) || r->prefetch || !q)
 		return -1;
-	Unprepare(r);
 	if ((res = Prepare(r)) < 1)
 		return res;
-	dec = r->codec;
 
-	return dec->seek(r, framePos);
+	return ring_fill(r, q, nFrames);
 }
 
 int
@@ -330,8 +818,9 @@ AIFF_ReadSamples16Bit(AIFF_Ref r, int16_t * samples, unsigned int n)
 	unsigned int 	 len, i;
 	int 		 h;
 	void		*buf;
+	STATS_TIMER(t)
 
-	if (NULL == r || 0 == (r->flags & F_RDONLY))
+	if (NULL == r || 0 == (r->flags & F_RDONLY) || r->prefetch || r->resampler)
 		return -1;
 	if (0 == n || 0 != (n % r->nChannels))
 		return 0;
@@ -350,6 +839,7 @@ AIFF_ReadSamples16Bit(AIFF_Ref r, int16_t * samples, unsigned int n)
 		return -1;
 	n = h / r->segmentSize;
 
+	STATS_START(t);
 	switch (r->segmentSize) {
 	case sizeof(int8_t): {
 		int8_t *p = buf;
@@ -393,6 +883,7 @@ AIFF_ReadSamples16Bit(AIFF_Ref r, int16_t * samples, unsigned int n)
 	default:
 		return 0;
 	}
+	STATS_STOP(r, convertNanos, t);
 
 	return n;
 }
@@ -403,8 +894,9 @@ AIFF_ReadSamples32Bit(AIFF_Ref r, int32_t * samples, unsigned int n)
 	unsigned int 	 len, i;
 	int 		 h;
 	void		*buf;	
+	STATS_TIMER(t)
 
-	if (NULL == r || 0 == (r->flags & F_RDONLY))
+	if (NULL == r || 0 == (r->flags & F_RDONLY) || r->prefetch || r->resampler)
 		return -1;
 	if (0 == n || 0 != (n % r->nChannels))
 		return 0;
@@ -423,6 +915,7 @@ AIFF_ReadSamples32Bit(AIFF_Ref r, int32_t * samples, unsigned int n)
 		return -1;
 	n = h / r->segmentSize;
 
+	STATS_START(t);
 	switch (r->segmentSize) {
 	case 3: { /* XXX -- this is gross. */
 		uint8_t *rp = (uint8_t *) buf;
@@ -466,22 +959,31 @@ AIFF_ReadSamples32Bit(AIFF_Ref r, int32_t * samples, unsigned int n)
 	default:
 		return 0;
 	}
+	STATS_STOP(r, convertNanos, t);
 
 	return n;
 }
 
 
-static void 
+static int 
 AIFF_ReadClose(AIFF_Ref r)
 {
-	int 	i;
+	int 	i, ret = 1;
 	
+	prefetch_destroy(r, NULL);
+	resample_destroy(r);
 	for (i = 0; i < kAIFFNBufs; ++i)
 		AIFFBufDelete(r, i);
 
 	Unprepare(r);
-	fclose(r->fd);
+	if (fclose(r->fd) != 0 && (r->flags & F_RDWR))
+		ret = -1;
+	free(r->chunks);
+	DropMarkerIndex(r);
+	STATS_MERGE(r);
 	free(r);
+
+	return ret;
 }
 
 static AIFF_Ref 
@@ -496,6 +998,7 @@ AIFF_WriteOpen(const char *file, int flags)
 err0:
 		return NULL;
 	}
+	STATS_RESET(w);
 
 	w->fd = fopen(file, "wb");
 	if (w->fd == NULL) {
@@ -517,7 +1020,21 @@ err2:
 		goto err1;
 	}
 	w->stat = 0;
+	w->nChannels = 0;
 	w->segmentSize = 0;
+	w->prefetch = NULL;
+	w->spool = NULL;
+	w->chunks = NULL;
+	w->nChunks = 0;
+	w->markerIndex = NULL;
+	w->trailer = NULL;
+	w->trailerLen = 0;
+	w->checkpoint = NULL;
+	w->checksum = NULL;
+	w->resampler = NULL;
+	w->dither = NULL;
+	w->queued = NULL;
+	w->nQueued = w->maxQueued = 0;
 	
 	memset(w->buf, 0, sizeof(w->buf));
 
@@ -562,10 +1079,111 @@ err2:
 	return w;
 }
 
+/*
+ * Reopen an existing file to write more samples after its sound data.
+ * The reference is returned ready for AIFF_WriteSamples; the chunks that
+ * followed the SSND chunk are kept in memory and written back after the
+ * new samples by AIFF_EndWritingSamples (or AIFF_CloseFile).
+ */
+static AIFF_Ref
+AIFF_AppendOpen(const char *file, int flags)
+{
+	AIFF_Ref w;
+	FILE *fd;
+	IFFChunkEntry *c, *comm = NULL, *ssnd = NULL;
+	SoundChunk s;
+	uint64_t frameBytes, nFrames, dataEnd, tailStart, end = 12;
+	int i;
+
+	if (flags & (F_RDONLY | F_RDWR | F_NOTSEEKABLE))
+		return NULL;
+	if ((fd = fopen(file, "r+b")) == NULL)
+		return NULL;
+	if ((w = AIFFReadOpenStream(fd, 0, NULL)) == NULL)
+		return NULL;
+
+	/* only what AIFF_SetAudioFormat could have written */
+	switch (w->audioFormat) {
+	case AUDIO_FORMAT_LPCM:
+		frameBytes = (uint64_t) w->segmentSize * w->nChannels;
+		break;
+	case AUDIO_FORMAT_ALAW:
+	case AUDIO_FORMAT_ULAW:
+		frameBytes = (uint64_t) w->nChannels;
+		break;
+	default:
+		goto err;
+	}
+	if (!w->chunks || frameBytes == 0)
+		goto err;
+
+	for (i = 0; i < w->nChunks; i++) {
+		c = &w->chunks[i];
+		if (c->id == AIFF_COMM && !comm)
+			comm = c;
+		else if (c->id == AIFF_SSND && !ssnd)
+			ssnd = c;
+		end = c->offset + c->len + (c->len & 1);
+	}
+	if (!comm || !ssnd || ssnd->len < 8)
+		goto err;
+	if (fseek(w->fd, (long) ssnd->offset, SEEK_SET) < 0 ||
+	    fread(&s, 1, 8, w->fd) != 8)
+		goto err;
+	s.offset = ARRANGE_BE32(s.offset);
+	if (s.offset > ssnd->len - 8)
+		goto err;
+
+	/*
+	 * The new samples go right after the last whole frame:
+	 * this drops the pad byte, if any.
+	 */
+	nFrames = (ssnd->len - 8 - s.offset) / frameBytes;
+	nFrames = MIN(nFrames, w->nSamples);
+	dataEnd = ssnd->offset + 8 + s.offset + nFrames * frameBytes;
+	tailStart = ssnd->offset + ssnd->len + (ssnd->len & 1);
+
+	if (end > tailStart) {
+		if (end - tailStart > 0xFFFFFFFFU)
+			goto err;
+		w->trailerLen = (uint32_t) (end - tailStart);
+		if ((w->trailer = malloc(w->trailerLen)) == NULL)
+			goto err;
+		if (fseek(w->fd, (long) tailStart, SEEK_SET) < 0 ||
+		    fread(w->trailer, 1, w->trailerLen, w->fd) != w->trailerLen)
+			goto err;
+	}
+	if (fseek(w->fd, (long) dataEnd, SEEK_SET) < 0)
+		goto err;
+
+	w->flags = F_WRONLY | F_APPEND | (w->flags & (LPCM_BIG_ENDIAN | LPCM_LTE_ENDIAN));
+	if (w->format == AIFF_TYPE_AIFC)
+		w->flags |= F_AIFC;
+	w->commonOffset = comm->offset - 8;
+	w->soundOffset = ssnd->offset - 8;
+	w->oldEnd = end;
+	w->len = dataEnd - 8;
+	w->nSamples = nFrames * w->nChannels;
+	w->sampleBytes = s.offset + nFrames * frameBytes;
+	w->codec = FindCodec(w->audioFormat);
+	w->stat = 2;
+	free(w->chunks);
+	w->chunks = NULL;
+	w->nChunks = 0;
+
+	return w;
+err:
+	free(w->trailer);
+	free(w->chunks);
+	fclose(w->fd);
+	free(w);
+	return NULL;
+}
+
 int 
 AIFF_SetAttribute(AIFF_Ref w, IFFType attr, char *value)
 {
-	if (!w || !(w->flags & F_WRONLY))
+	if (!w || !(w->flags & F_WRONLY) || (w->flags & F_APPEND))
 		return -1;
 	return set_iff_attribute(w, attr, value);
 }
@@ -574,37 +1192,48 @@ int
 AIFF_CloneAttributes(AIFF_Ref w, AIFF_Ref r, int cloneMarkers)
 {
 	int rval, ret;
-	int doneReadingMarkers;
 
-	if (!w || !(w->flags & F_WRONLY))
+	if (!w || !(w->flags & F_WRONLY) || (w->flags & F_APPEND))
 		return -1;
 	
 	/*
 	 * first of all, clone the IFF attributes
 	 */
 	rval = clone_iff_attributes(w, r);
-	
-	doneReadingMarkers = !cloneMarkers;
-	if (!doneReadingMarkers) {
-		int mId;
-		uint64_t mPos;
-		char *mName;
-		
-		if ((ret = AIFF_StartWritingMarkers(w)) < 1)
+
+	/*
+	 * then the comments; those attached to
+	 * markers only along with the markers
+	 */
+	if (w->stat != 2 && w->stat != 4) {
+		AIFF_CommentList *comments;
+		size_t i, n;
+
+		if ((ret = AIFF_ReadAllComments(r, &comments)) < 0)
 			return ret;
-		
-		do {
-			if (AIFF_ReadMarker(r, &mId, &mPos, &mName) < 1)
-				doneReadingMarkers = 1;
-			else {
-				ret = AIFF_WriteMarker(w, mPos, mName);
-				/* Preserve previous errors. */
-				rval = (rval > 0 ? ret : rval);
+		if (ret > 0) {
+			for (i = 0, n = 0; i < comments->nComments; ++i) {
+				if (cloneMarkers || comments->comments[i].marker == 0)
+					comments->comments[n++] = comments->comments[i];
 			}
-		} while (!doneReadingMarkers);
-		
-		if ((ret = AIFF_EndWritingMarkers(w)) < 1)
+			ret = (n > 0 ? AIFF_WriteComments(w, comments->comments, n) : 1);
+			AIFF_FreeComments(comments);
+			/* Preserve previous errors. */
+			rval = (rval > 0 ? ret : rval);
+		}
+	}
+	
+	if (cloneMarkers) {
+		AIFF_MarkerList *markers;
+
+		if ((ret = AIFF_ReadAllMarkers(r, &markers)) < 0)
 			return ret;
+		if (ret > 0) {
+			ret = AIFF_WriteMarkers(w, markers->markers, markers->nMarkers);
+			AIFF_FreeMarkers(markers);
+			if (ret < 1)
+				return ret;
+		}
 	}
 	
 	return rval;
@@ -757,6 +1386,8 @@ static int
 DoWriteSamples(AIFF_Ref w, void *samples, size_t len, int readOnlyBuf)
 {
         struct codec    *c = w->codec;
+	uint64_t bytes;
+	int res;
         
         if (NULL == w || !(w->flags & F_WRONLY))
 		return -1;
@@ -765,26 +1396,45 @@ DoWriteSamples(AIFF_Ref w, void *samples, size_t len, int readOnlyBuf)
         
         ASSERT(NULL != c);
 
-        return ((*c->write_lpcm)(w, samples, len, readOnlyBuf));
+	if (w->spool) {
+		if (len % w->segmentSize)
+			return 0;
+		return spool_write(w, samples, len, 0);
+	}
+
+	bytes = w->sampleBytes;
+	TRACE_BEGIN(w, kTraceWriteLPCM);
+        res = (*c->write_lpcm)(w, samples, len, readOnlyBuf);
+	TRACE_END(w, kTraceWriteLPCM, w->sampleBytes - bytes);
+	if (res < 1)
+		return res;
+	return checkpoint_update(w);
 }
 
 int
 AIFF_WriteSamplesRaw(AIFF_Ref w, void *samples, size_t len)
 {
+	STATS_TIMER(t)
+
 	if (!w || 0 == (w->flags & F_WRONLY))
 		return (-1);
 	if (w->stat != 2)
 		return (0);
+	if (w->spool)
+		return spool_write(w, samples, len, 1);
 
+	checksum_update(w, samples, len);
+	STATS_START(t);
 	if (fwrite(samples, 1, len, w->fd) != len) {
 		return (-1);
 	}
+	STATS_WRITE(w, len, t);
 
-        /* FIXME w->nSamples */
+	w->nSamples += len / (FrameSize(w) / w->nChannels);
 	w->sampleBytes += len;
 	w->len += len;
 
-	return (1);
+	return (checkpoint_update(w));
 }
 
 int
@@ -800,6 +1450,7 @@ AIFF_WriteSamples32Bit(AIFF_Ref w, int32_t * samples, int n)
 	int i, j;
 	unsigned int len;
 	void *buffer;
+	STATS_TIMER(t)
 
 	if (!w || !(w->flags & F_WRONLY))
 		return -1;
@@ -808,11 +1459,12 @@ AIFF_WriteSamples32Bit(AIFF_Ref w, int32_t * samples, int n)
 	len = n * w->segmentSize;
 
 	if (w->segmentSize == 4)
-		return DoWriteSamples(w, samples, len, 1) >> 2;
+		return DoWriteSamples(w, samples, len, 1);
 	
 	if (NULL == (buffer = AIFFBufAllocate(w, kAIFFBufExt, len)))
 		return -1;
 
+	STATS_START(t);
 	switch (w->segmentSize) {
 	case 3:
 	{
@@ -854,10 +1506,65 @@ AIFF_WriteSamples32Bit(AIFF_Ref w, int32_t * samples, int n)
 		break;
 	}
 	}
+	STATS_STOP(w, convertNanos, t);
 
 	return DoWriteSamples(w, buffer, len, 0);
 }
 
+/*
+ * Hand the encoding and writing of the samples
+ * over to a worker thread (see spool.c).
+ */
+int
+AIFF_StartAsyncWrite(AIFF_Ref w, int nBlocks, int blockFrames)
+{
+	if (!w || !(w->flags & F_WRONLY) || w->stat != 2 || w->spool)
+		return -1;
+
+	return spool_start(w, nBlocks, blockFrames);
+}
+
+int
+AIFF_AsyncWriteStats(AIFF_Ref w, unsigned int *highWater, uint64_t *dropped)
+{
+	if (!w || !(w->flags & F_WRONLY) || !w->spool)
+		return -1;
+
+	spool_stats(w, highWater, dropped);
+	return 1;
+}
+
+/*
+ * Put back the chunks that followed the sound data of a file
+ * reopened with F_APPEND. If the file is now shorter than it was,
+ * a filler chunk covers the rest, so no stale chunk is found there.
+ */
+static int
+EndAppending(AIFF_Ref w)
+{
+	IFFChunk chk;
+	uint64_t end;
+
+	if (w->trailer) {
+		if (fwrite(w->trailer, 1, w->trailerLen, w->fd) != w->trailerLen)
+			return -1;
+		w->len += w->trailerLen;
+		free(w->trailer);
+		w->trailer = NULL;
+	}
+	end = w->len + 8;
+	if (w->oldEnd >= end + 8) {
+		chk.id = ARRANGE_BE32(IFF_FILLER);
+		chk.len = (uint32_t) (w->oldEnd - end - 8);
+		chk.len = ARRANGE_BE32(chk.len);
+		if (fwrite(&chk, sizeof(chk), 1, w->fd) != 1)
+			return -1;
+		w->len = w->oldEnd - 8;
+	}
+
+	return 1;
+}
+
 int 
 AIFF_EndWritingSamples(AIFF_Ref w)
 {
@@ -869,19 +1576,25 @@ AIFF_EndWritingSamples(AIFF_Ref w)
 		return -1;
 	if (w->stat != 2)
 		return 0;
+	if (spool_finish(w) < 1)
+		return -1;
 
 	AIFFBufDelete(w, kAIFFBufExt);
+	/* the pad byte is not part of the chunk */
+	chk.len = w->sampleBytes + sizeof(SoundChunk);
 	if (w->sampleBytes & 1) {
 		fputc(0, w->fd);
-		w->sampleBytes++;
 		w->len++;
 	}
+	if (w->flags & F_APPEND) {
+		if (EndAppending(w) < 0)
+			return -1;
+	}
 	
 	curpos = w->len + 8;
 	of = w->soundOffset;
 	
 	chk.id = ARRANGE_BE32(AIFF_SSND);
-	chk.len = w->sampleBytes + sizeof(SoundChunk);
 	chk.len = ARRANGE_BE32(chk.len);
 
 	if (fseek(w->fd, of, SEEK_SET) < 0 || 
@@ -916,7 +1629,7 @@ AIFF_StartWritingMarkers(AIFF_Ref w)
 	IFFChunk chk;
 	uint16_t nMarkers = 0;
 
-	if (!w || !(w->flags & F_WRONLY))
+	if (!w || !(w->flags & F_WRONLY) || (w->flags & F_APPEND))
 		return -1;
 	if (w->stat != 3)
 		return -1;
@@ -984,12 +1697,19 @@ AIFF_EndWritingMarkers(AIFF_Ref w)
 	uint32_t cklen, curpos;
 	long offset;
 	uint16_t nMarkers;
+	size_t i;
 
 	if (!w || !(w->flags & F_WRONLY))
 		return -1;
 	if (w->stat != 4)
 		return -1;
 
+	for (i = 0; i < w->nQueued; i++) {
+		if (AIFF_WriteMarker(w, w->queued[i].position, w->queued[i].name) < 0)
+			return -1;
+	}
+	FreeQueuedMarkers(w);
+
 	curpos = w->len + 8;
 	cklen = w->len - w->markerOffset;
 	cklen = ARRANGE_BE32(cklen);
@@ -1019,14 +1739,250 @@ AIFF_EndWritingMarkers(AIFF_Ref w)
 	return 1;
 }
 
+/*
+ * Write a whole chunk made by build_aifx_markers or build_aifx_comments.
+ */
+static int
+WriteChunk(AIFF_Ref w, uint8_t *chunk, uint32_t cklen)
+{
+	size_t len = 8 + (size_t) cklen + (cklen & 1);
+
+	if (!chunk)
+		return -1;
+	if (fwrite(chunk, 1, len, w->fd) != len) {
+		free(chunk);
+		return -1;
+	}
+	free(chunk);
+	w->len += len;
+
+	return 1;
+}
+
+/*
+ * Write the whole MARK chunk with a single fwrite. A marker
+ * with id 0 gets the id (index + 1), as with AIFF_WriteMarker.
+ */
+int
+AIFF_WriteMarkers(AIFF_Ref w, const AIFF_Marker * markers, size_t n)
+{
+	uint32_t cklen;
+	uint8_t *chunk;
+
+	if (!w || !(w->flags & F_WRONLY) || (n > 0 && !markers))
+		return -1;
+	if (w->stat != 3 || (w->flags & F_APPEND))
+		return -1;
+	if (n + w->nQueued > 0xFFFF)
+		return 0;
+
+	if (w->nQueued > 0) {
+		/* add the queued markers, which have id 0 */
+		AIFF_Marker *all;
+
+		if ((all = malloc((n + w->nQueued) * sizeof(AIFF_Marker))) == NULL)
+			return -1;
+		if (n > 0)
+			memcpy(all, markers, n * sizeof(AIFF_Marker));
+		memcpy(all + n, w->queued, w->nQueued * sizeof(AIFF_Marker));
+		if (last_aifx_marker_id(all, n + w->nQueued) > 0xFFFF) {
+			free(all);
+			return 0;
+		}
+		chunk = build_aifx_markers(all, n + w->nQueued, &cklen);
+		free(all);
+		FreeQueuedMarkers(w);
+	} else {
+		if (last_aifx_marker_id(markers, n) > 0xFFFF)
+			return 0;
+		chunk = build_aifx_markers(markers, n, &cklen);
+	}
+	return WriteChunk(w, chunk, cklen);
+}
+
+/*
+ * Queue a marker to be written along with those written by
+ * AIFF_WriteMarkers or AIFF_StartWritingMarkers, or alone by
+ * AIFF_CloseFile (see AIFF_CopyFrames).
+ */
+int
+AIFFQueueMarker(AIFF_Ref w, uint64_t position, const char *name)
+{
+	AIFF_Marker *m;
+	size_t max;
+
+	if (w->nQueued == w->maxQueued) {
+		max = (w->maxQueued ? 2 * w->maxQueued : 16);
+		if ((m = realloc(w->queued, max * sizeof(AIFF_Marker))) == NULL)
+			return -1;
+		w->queued = m;
+		w->maxQueued = max;
+	}
+	m = &w->queued[w->nQueued];
+	m->id = 0;
+	m->position = position;
+	m->name = NULL;
+	if (name) {
+		if ((m->name = malloc(strlen(name) + 1)) == NULL)
+			return -1;
+		strcpy(m->name, name);
+	}
+	w->nQueued++;
+
+	return 1;
+}
+
+static void
+FreeQueuedMarkers(AIFF_Ref w)
+{
+	size_t i;
+
+	for (i = 0; i < w->nQueued; i++)
+		free(w->queued[i].name);
+	free(w->queued);
+	w->queued = NULL;
+	w->nQueued = w->maxQueued = 0;
+}
+
+/*
+ * Write a COMT chunk with the 'n' comments, with a single fwrite.
+ */
+int
+AIFF_WriteComments(AIFF_Ref w, const AIFF_Comment * comments, size_t n)
+{
+	uint32_t cklen;
+	uint8_t *chunk;
+
+	if (!w || !(w->flags & F_WRONLY) || (n > 0 && !comments))
+		return -1;
+	if (w->stat == 2 || w->stat == 4 || (w->flags & F_APPEND))
+		return -1;
+	if (n > 0xFFFF)
+		return 0;
+
+	chunk = build_aifx_comments(comments, n, &cklen);
+	return WriteChunk(w, chunk, cklen);
+}
+
+/*
+ *	In-place metadata editing, on files opened with F_RDWR.
+ */
+
+static int
+UpdateChunk(AIFF_Ref r, IFFType id, uint8_t *chunk, uint32_t cklen)
+{
+	int res;
+
+	Unprepare(r);
+	res = replace_iff_chunk(r, id, chunk, cklen);
+	free(chunk);
+	DropMarkerIndex(r);
+
+	return res;
+}
+
+static int
+Updatable(AIFF_Ref r)
+{
+	return (r && (r->flags & F_RDWR) && !r->prefetch && r->chunks);
+}
+
+/*
+ * Set the attribute 'attr', or remove it if 'value' is NULL.
+ */
+int
+AIFF_UpdateAttribute(AIFF_Ref r, IFFType attr, const char *value)
+{
+	IFFChunk chk;
+	uint8_t *chunk = NULL;
+	size_t len = 0;
+
+	if (!Updatable(r))
+		return -1;
+	switch (attr) {
+	case AIFF_NAME:
+	case AIFF_AUTH:
+	case AIFF_COPY:
+	case AIFF_ANNO:
+		break;
+	default:
+		return -1;
+	}
+
+	if (value) {
+		if ((len = strlen(value)) > 0xFFFFFFF0U)
+			return -1;
+		if ((chunk = malloc(8 + len + 1)) == NULL)
+			return -1;
+		chk.id = ARRANGE_BE32(attr);
+		chk.len = (uint32_t) len;
+		chk.len = ARRANGE_BE32(chk.len);
+		memcpy(chunk, &chk, 8);
+		memcpy(chunk + 8, value, len);
+		chunk[8 + len] = 0; /* pad */
+	}
+
+	return UpdateChunk(r, attr, chunk, (uint32_t) len);
+}
+
+/*
+ * Replace the markers with the 'n' in 'markers' (see
+ * AIFF_WriteMarkers), or remove them if 'n' is 0.
+ */
+int
+AIFF_UpdateMarkers(AIFF_Ref r, const AIFF_Marker * markers, size_t n)
+{
+	uint8_t *chunk = NULL;
+	uint32_t cklen = 0;
+
+	if (!Updatable(r) || (n > 0 && !markers))
+		return -1;
+	if (n > 0xFFFF || last_aifx_marker_id(markers, n) > 0xFFFF)
+		return 0;
+	if (n > 0 && (chunk = build_aifx_markers(markers, n, &cklen)) == NULL)
+		return -1;
+
+	return UpdateChunk(r, AIFF_MARK, chunk, cklen);
+}
+
+/*
+ * Replace the comments with the 'n' in 'comments' (see
+ * AIFF_WriteComments), or remove them if 'n' is 0.
+ */
+int
+AIFF_UpdateComments(AIFF_Ref r, const AIFF_Comment * comments, size_t n)
+{
+	uint8_t *chunk = NULL;
+	uint32_t cklen = 0;
+
+	if (!Updatable(r) || (n > 0 && !comments))
+		return -1;
+	if (n > 0xFFFF)
+		return 0;
+	if (n > 0 && (chunk = build_aifx_comments(comments, n, &cklen)) == NULL)
+		return -1;
+
+	return UpdateChunk(r, AIFF_COMT, chunk, cklen);
+}
+
 static int 
 AIFF_WriteClose(AIFF_Ref w)
 {
 	int i, ret = 1;
 	IFFHeader hdr;
 
-	if (w->stat != 3)
+	TRACE_BEGIN(w, kTraceClose);
+	if ((w->flags & F_APPEND) && w->stat == 2 &&
+	    AIFF_EndWritingSamples(w) < 1)
+		ret = -1;
+	else if (spool_finish(w) < 1)
+		ret = -1;
+	else if (w->stat != 3)
 		ret = 2;
+	else if (w->nQueued > 0 && !(w->flags & F_APPEND) &&
+	    AIFF_WriteMarkers(w, NULL, 0) < 1)
+		ret = -1;
+	FreeQueuedMarkers(w);
 	
 	hdr.hid = ARRANGE_BE32(AIFF_FORM);
 	hdr.len = w->len;
@@ -1036,13 +1992,15 @@ AIFF_WriteClose(AIFF_Ref w)
 	else
 		hdr.fid = ARRANGE_BE32(AIFF_AIFF);
 
-	if (fseek(w->fd, 0, SEEK_SET) < 0) {
-		fclose(w->fd);
-		free(w);
-		return -1;
-	}
-	if (fwrite(&hdr, 1, sizeof(hdr), w->fd) != sizeof(hdr)) {
+	if (fseek(w->fd, 0, SEEK_SET) < 0 ||
+	    fwrite(&hdr, 1, sizeof(hdr), w->fd) != sizeof(hdr)) {
 		fclose(w->fd);
+		free(w->trailer);
+		checkpoint_destroy(w);
+		checksum_destroy(w);
+		dither_destroy(w);
+		STATS_MERGE(w);
+		TRACE_END(w, kTraceClose, 0);
 		free(w);
 		return -1;
 	}
@@ -1052,10 +2010,39 @@ AIFF_WriteClose(AIFF_Ref w)
 	for (i = 0; i < kAIFFNBufs; ++i)
 		AIFFBufDelete(w, i);
 
+	free(w->trailer);
+	checkpoint_destroy(w);
+	checksum_destroy(w);
+	dither_destroy(w);
+	STATS_MERGE(w);
+	TRACE_END(w, kTraceClose, w->len + 8);
 	free(w);
 	return ret;
 }
 
+/*
+ *	Positional access, for the modules that read
+ *	the sound data without going through the stream.
+ */
+
+int
+AIFFPrepare (AIFF_Ref r)
+{
+	return Prepare(r);
+}
+
+int
+AIFFFrameSize (AIFF_Ref r)
+{
+	return FrameSize(r);
+}
+
+int
+AIFFWriteSamples (AIFF_Ref w, void *samples, size_t len, int readOnlyBuf)
+{
+	return DoWriteSamples(w, samples, len, readOnlyBuf);
+}
+
 /*
  *	Buffer manipulation.
  */
@@ -1084,6 +2071,7 @@ AIFFBufAllocate (AIFF_Ref a, int nbuf, unsigned int len)
 	
 	b = &a->buf[nbuf];
 	if (b->len < len) {
+		STATS_ADD(a, bufAllocs, 1);
 		if (b->ptr)
 			free(b->ptr);
 		b->ptr = malloc(len);
@@ -57,6 +57,22 @@ struct s_AIFF_Rec;
 
 typedef struct s_AIFF_Rec* AIFF_Ref;
 
+struct s_AIFF_Ring;
+
+typedef struct s_AIFF_Ring* AIFF_RingRef;
+
+struct s_AIFF_Engine;
+
+typedef struct s_AIFF_Engine* AIFF_EngineRef;
+
+struct s_AIFF_Cache;
+
+typedef struct s_AIFF_Cache* AIFF_CacheRef;
+
+struct s_AIFF_Overview;
+
+typedef struct s_AIFF_Overview* AIFF_OverviewRef;
+
 /* 
  * == Interchange File Format (IFF) attributes ==
  */
@@ -103,6 +119,49 @@ static char AnnoID[4] = {'O', 'N', 'N', 'A'};
 #define F_AIFC		(1<<4)
 #define F_OPTIMIZE	(F_AIFC | LPCM_SYS_ENDIAN)
 #define F_NOTSEEKABLE	(1<<5)
+#define F_RDWR		(1<<6)
+#define F_APPEND	(1<<7)
+
+/* Frame ring formats */
+#define kRingLPCM	0
+#define kRingFloat	1
+
+/* Chunks found by AIFF_Probe */
+#define kInfoName	(1<<0)
+#define kInfoAuth	(1<<1)
+#define kInfoCopy	(1<<2)
+#define kInfoAnno	(1<<3)
+#define kInfoMarkers	(1<<4)
+#define kInfoInstrument	(1<<5)
+#define kInfoComments	(1<<6)
+
+/* Read engine back-ends */
+#define kEngineAny	0
+#define kEngineURing	1
+#define kEngineThreads	2
+
+/* Resampler qualities */
+#define kResampleLinear	0
+#define kResampleSinc	1
+
+/* Dither of AIFF_WriteSamplesFloat */
+#define kDitherNone	0
+#define kDitherTPDF	1
+#define kDitherShaped	2
+
+/* Traced operations */
+#define kTraceOpen	0
+#define kTracePrepare	1
+#define kTraceFindChunk	2
+#define kTraceReadLPCM	3
+#define kTraceReadFloat	4
+#define kTraceWriteLPCM	5
+#define kTraceSeek	6
+#define kTraceClose	7
+
+/* Trace phases */
+#define kTraceBegin	0
+#define kTraceEnd	1
 
 /* Play modes */
 #define kModeNoLooping			0
@@ -130,17 +189,183 @@ struct s_Instrument
 } ;
 typedef struct s_Instrument Instrument ;
 
+struct s_AIFF_Marker
+{
+	MarkerId id ;
+	uint64_t position ;
+	char* name ;
+} ;
+typedef struct s_AIFF_Marker AIFF_Marker ;
+
+struct s_AIFF_MarkerList
+{
+	AIFF_Marker* markers ;
+	size_t nMarkers ;
+} ;
+typedef struct s_AIFF_MarkerList AIFF_MarkerList ;
+
+struct s_AIFF_Comment
+{
+	uint32_t timeStamp ;
+	MarkerId marker ;
+	char* text ;
+} ;
+typedef struct s_AIFF_Comment AIFF_Comment ;
+
+struct s_AIFF_CommentList
+{
+	AIFF_Comment* comments ;
+	size_t nComments ;
+} ;
+typedef struct s_AIFF_CommentList AIFF_CommentList ;
+
+struct s_AIFF_Region
+{
+	uint64_t start ;
+	uint64_t end ;
+	const char* name ;
+	MarkerId id ;
+	size_t next ;
+} ;
+typedef struct s_AIFF_Region AIFF_Region ;
+
+struct s_AIFF_Completion
+{
+	AIFF_Ref ref ;
+	void* userData ;
+	float* samples ;
+	int nFrames ;
+} ;
+typedef struct s_AIFF_Completion AIFF_Completion ;
+
+struct s_AIFF_Job
+{
+	const char* input ;
+	const char* output ;
+	int flags ;
+	IFFType encoding ;
+	int bitsPerSample ;
+	int result ;
+	uint64_t nFrames ;
+	double seconds ;
+	double framesPerSecond ;
+} ;
+typedef struct s_AIFF_Job AIFF_Job ;
+
+struct s_AIFF_Info
+{
+	int flags ;
+	IFFType encoding ;
+	int channels ;
+	int bitsPerSample ;
+	int segmentSize ;
+	double samplingRate ;
+	uint64_t nSamples ;
+	uint64_t soundOffset ;
+	uint64_t soundLength ;
+	int chunks ;
+} ;
+typedef struct s_AIFF_Info AIFF_Info ;
+
+struct s_AIFF_Bin
+{
+	float min ;
+	float max ;
+	float rms ;
+} ;
+typedef struct s_AIFF_Bin AIFF_Bin ;
+
+struct s_AIFF_ChannelStats
+{
+	float peak ;
+	float truePeak ;
+	double rms ;
+	double dc ;
+	uint64_t clipped ;
+} ;
+typedef struct s_AIFF_ChannelStats AIFF_ChannelStats ;
+
+struct s_AIFF_Stats
+{
+	uint64_t nFrames ;
+	int nChannels ;
+	double loudness ;
+	AIFF_ChannelStats* channels ;
+} ;
+typedef struct s_AIFF_Stats AIFF_Stats ;
+
+struct s_AIFF_Trim
+{
+	uint64_t start ;
+	uint64_t end ;
+} ;
+typedef struct s_AIFF_Trim AIFF_Trim ;
+
+struct s_AIFF_IOStats
+{
+	uint64_t bytesRead ;
+	uint64_t bytesWritten ;
+	uint64_t readCalls ;
+	uint64_t writeCalls ;
+	uint64_t seeks ;
+	uint64_t chunkScans ;
+	uint64_t bufAllocs ;
+	uint64_t ioNanos ;
+	uint64_t swapNanos ;
+	uint64_t convertNanos ;
+} ;
+typedef struct s_AIFF_IOStats AIFF_IOStats ;
+
+typedef void (*AIFF_TraceFunc)(void*,AIFF_Ref,int,int,uint64_t,uint64_t) ;
+
 /* == Function prototypes == */
 AIFF_Ref AIFF_OpenFile(const char *, int) ;
 int AIFF_CloseFile(AIFF_Ref) ;
+int AIFF_Probe(const char*,AIFF_Info*) ;
+int AIFF_ProbeMany(const char**,AIFF_Info*,int*,int,int) ;
+AIFF_CacheRef AIFF_CacheCreate(unsigned int) ;
+void AIFF_CacheDelete(AIFF_CacheRef) ;
+AIFF_Ref AIFF_OpenCached(AIFF_CacheRef,const char*,int) ;
+int AIFF_CacheStats(AIFF_CacheRef,uint64_t*,uint64_t*) ;
+int AIFF_CacheSave(AIFF_CacheRef,const char*) ;
+int AIFF_CacheLoad(AIFF_CacheRef,const char*) ;
 char* AIFF_GetAttribute(AIFF_Ref,IFFType) ;
 int AIFF_GetInstrumentData(AIFF_Ref,Instrument*) ;
 size_t AIFF_ReadSamples(AIFF_Ref,void*,size_t) ;
 int AIFF_ReadSamplesFloat(AIFF_Ref r, float *buffer, int n) ;
 int AIFF_Seek(AIFF_Ref,uint64_t) ;
+int AIFF_SetOutputRate(AIFF_Ref,double,int) ;
+int AIFF_StartPrefetch(AIFF_Ref,int,int) ;
+int AIFF_StopPrefetch(AIFF_Ref) ;
+uint64_t AIFF_PrefetchUnderruns(AIFF_Ref) ;
+AIFF_RingRef AIFF_RingCreate(AIFF_Ref,unsigned int,int) ;
+void AIFF_RingDelete(AIFF_RingRef) ;
+void AIFF_RingReset(AIFF_RingRef) ;
+int AIFF_RingFill(AIFF_Ref,AIFF_RingRef,unsigned int) ;
+unsigned int AIFF_RingRead(AIFF_RingRef,void*,unsigned int) ;
+unsigned int AIFF_RingReadable(AIFF_RingRef) ;
+unsigned int AIFF_RingWritable(AIFF_RingRef) ;
+int AIFF_RingEnded(AIFF_RingRef) ;
+AIFF_EngineRef AIFF_EngineCreate(int,int,int) ;
+void AIFF_EngineDelete(AIFF_EngineRef) ;
+int AIFF_EngineBackend(AIFF_EngineRef) ;
+int AIFF_EngineSubmit(AIFF_EngineRef,AIFF_Ref,uint64_t,unsigned int,float*,void*) ;
+int AIFF_EnginePoll(AIFF_EngineRef,AIFF_Completion*,int,int) ;
+unsigned int AIFF_EnginePending(AIFF_EngineRef) ;
+int64_t AIFF_DecodeRangeParallel(AIFF_Ref,uint64_t,uint64_t,float*,int) ;
 int AIFF_ReadSamples16Bit(AIFF_Ref,int16_t*,unsigned int) ;
 int AIFF_ReadSamples32Bit(AIFF_Ref,int32_t*,unsigned int) ;
 int AIFF_ReadMarker(AIFF_Ref,int*,uint64_t*,char**) ;
+int AIFF_ReadAllMarkers(AIFF_Ref,AIFF_MarkerList**) ;
+void AIFF_FreeMarkers(AIFF_MarkerList*) ;
+const AIFF_Marker* AIFF_FindMarker(AIFF_Ref,MarkerId) ;
+const AIFF_Marker* AIFF_MarkerBefore(AIFF_Ref,uint64_t) ;
+const AIFF_Marker* AIFF_MarkerAfter(AIFF_Ref,uint64_t) ;
+int AIFF_GetRegion(AIFF_Ref,uint64_t,AIFF_Region*) ;
+int AIFF_NextRegion(AIFF_Ref,AIFF_Region*) ;
+int AIFF_ReadAllComments(AIFF_Ref,AIFF_CommentList**) ;
+void AIFF_FreeComments(AIFF_CommentList*) ;
+const AIFF_Comment* AIFF_MarkerComments(AIFF_Ref,MarkerId,size_t*) ;
 int AIFF_GetAudioFormat(AIFF_Ref,uint64_t*,int*,double*,int*,int*) ;
 int AIFF_SetAttribute(AIFF_Ref,IFFType,char*) ;
 int AIFF_CloneAttributes(AIFF_Ref w, AIFF_Ref r, int cloneMarkers) ;
@@ -150,10 +375,43 @@ int AIFF_StartWritingSamples(AIFF_Ref) ;
 int AIFF_WriteSamples(AIFF_Ref,void*,size_t) ;
 int AIFF_WriteSamplesRaw(AIFF_Ref,void*,size_t) ;
 int AIFF_WriteSamples32Bit(AIFF_Ref,int32_t*,int) ;
+int AIFF_WriteSamplesFloat(AIFF_Ref,const float*,int) ;
+int AIFF_SetDither(AIFF_Ref,int) ;
+int AIFF_StartAsyncWrite(AIFF_Ref,int,int) ;
+int AIFF_AsyncWriteStats(AIFF_Ref,unsigned int*,uint64_t*) ;
 int AIFF_EndWritingSamples(AIFF_Ref) ;
 int AIFF_StartWritingMarkers(AIFF_Ref) ;
 int AIFF_WriteMarker(AIFF_Ref,uint64_t,char*) ;
 int AIFF_EndWritingMarkers(AIFF_Ref) ;
+int AIFF_WriteMarkers(AIFF_Ref,const AIFF_Marker*,size_t) ;
+int AIFF_WriteComments(AIFF_Ref,const AIFF_Comment*,size_t) ;
+int AIFF_UpdateAttribute(AIFF_Ref,IFFType,const char*) ;
+int AIFF_UpdateMarkers(AIFF_Ref,const AIFF_Marker*,size_t) ;
+int AIFF_UpdateComments(AIFF_Ref,const AIFF_Comment*,size_t) ;
+int AIFF_SetCheckpoint(AIFF_Ref,uint64_t,int) ;
+int AIFF_Checkpoint(AIFF_Ref) ;
+int AIFF_RepairFile(const char*) ;
+int AIFF_CopyFrames(AIFF_Ref,AIFF_Ref,uint64_t,uint64_t) ;
+int AIFF_Concatenate(const char*,const char**,int) ;
+AIFF_OverviewRef AIFF_OverviewCreate(AIFF_Ref,const unsigned int*,int) ;
+void AIFF_OverviewDelete(AIFF_OverviewRef) ;
+int AIFF_OverviewFormat(AIFF_OverviewRef,int*,int*,uint64_t*) ;
+const AIFF_Bin* AIFF_OverviewBins(AIFF_OverviewRef,int,uint64_t,uint64_t,unsigned int*,uint64_t*) ;
+int AIFF_OverviewSave(AIFF_OverviewRef,const char*) ;
+AIFF_OverviewRef AIFF_OverviewLoad(const char*) ;
+int AIFF_Analyze(AIFF_Ref,AIFF_Stats*) ;
+void AIFF_FreeStats(AIFF_Stats*) ;
+int AIFF_Checksum(AIFF_Ref,uint64_t*) ;
+int AIFF_StartChecksum(AIFF_Ref) ;
+int AIFF_GetChecksum(AIFF_Ref,uint64_t*) ;
+int AIFF_FindSilence(AIFF_Ref,float,const float*,uint64_t,AIFF_Trim*) ;
+int AIFF_FindSilenceMany(const char**,AIFF_Trim*,int*,int,float,const float*,int,uint64_t,int) ;
+int AIFF_GetStats(AIFF_Ref,AIFF_IOStats*) ;
+void AIFF_SetTraceCallback(AIFF_TraceFunc,void*) ;
+const char* AIFF_TraceName(int) ;
+int AIFF_StartTraceFile(const char*) ;
+int AIFF_EndTraceFile(void) ;
+int AIFF_Transcode(AIFF_Job*,int,int,int) ;
 
 #if !defined(LIBAIFF) && !defined(LIBAIFF_NOCOMPAT)
 #define AIFF_ReadRef		AIFF_Ref
@@ -173,18 +431,60 @@ int AIFF_EndWritingMarkers(AIFF_Ref) ;
 #ifdef HAVE_ABORT
 #undef HAVE_ABORT
 #endif
+#ifdef ENABLE_STATS
+#undef ENABLE_STATS
+#endif
+#ifdef HAVE_ATOMIC_BUILTINS
+#undef HAVE_ATOMIC_BUILTINS
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+#undef HAVE_CLOCK_GETTIME
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+#undef HAVE_COPY_FILE_RANGE
+#endif
+#ifdef HAVE_FCNTL_H
+#undef HAVE_FCNTL_H
+#endif
+#ifdef HAVE_FDATASYNC
+#undef HAVE_FDATASYNC
+#endif
+#ifdef HAVE_FSYNC
+#undef HAVE_FSYNC
+#endif
 #ifdef HAVE_INTTYPES_H
 #undef HAVE_INTTYPES_H
 #endif
+#ifdef HAVE_LINUX_IO_URING_H
+#undef HAVE_LINUX_IO_URING_H
+#endif
 #ifdef HAVE_MEMORY_H
 #undef HAVE_MEMORY_H
 #endif
 #ifdef HAVE_MEMSET
 #undef HAVE_MEMSET
 #endif
+#ifdef HAVE_MMAP
+#undef HAVE_MMAP
+#endif
+#ifdef HAVE_PREAD
+#undef HAVE_PREAD
+#endif
+#ifdef HAVE_PTHREAD
+#undef HAVE_PTHREAD
+#endif
+#ifdef HAVE_PTHREAD_H
+#undef HAVE_PTHREAD_H
+#endif
+#ifdef HAVE_SEMAPHORE_H
+#undef HAVE_SEMAPHORE_H
+#endif
 #ifdef HAVE_STDINT_H
 #undef HAVE_STDINT_H
 #endif
+#ifdef HAVE_STDIO_H
+#undef HAVE_STDIO_H
+#endif
 #ifdef HAVE_STDLIB_H
 #undef HAVE_STDLIB_H
 #endif
@@ -194,12 +494,27 @@ int AIFF_EndWritingMarkers(AIFF_Ref) ;
 #ifdef HAVE_STRING_H
 #undef HAVE_STRING_H
 #endif
+#ifdef HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC
+#undef HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+#undef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#undef HAVE_SYS_MMAN_H
+#endif
 #ifdef HAVE_SYS_STAT_H
 #undef HAVE_SYS_STAT_H
 #endif
+#ifdef HAVE_SYS_SYSCALL_H
+#undef HAVE_SYS_SYSCALL_H
+#endif
 #ifdef HAVE_SYS_TYPES_H
 #undef HAVE_SYS_TYPES_H
 #endif
+#ifdef HAVE_SYS_UIO_H
+#undef HAVE_SYS_UIO_H
+#endif
 #ifdef HAVE_UNISTD_H
 #undef HAVE_UNISTD_H
 #endif
@@ -208,6 +523,7 @@ int AIFF_EndWritingMarkers(AIFF_Ref) ;
 #undef PACKAGE_NAME
 #undef PACKAGE_STRING
 #undef PACKAGE_TARNAME
+#undef PACKAGE_URL
 #undef PACKAGE_VERSION
 
 #ifdef STDC_HEADERS
@@ -124,6 +124,7 @@ lpcm_read_lpcm(AIFF_Ref r, void *buffer, size_t len)
 	size_t slen;
 	size_t bytes_in;
 	size_t bytesToRead;
+	STATS_TIMER(t)
 
 	n = len;
 	len -= n % r->segmentSize;
@@ -135,14 +136,18 @@ lpcm_read_lpcm(AIFF_Ref r, void *buffer, size_t len)
 	if (bytesToRead == 0)
 		return 0;
 
+	STATS_START(t);
 	bytes_in = fread(buffer, 1, bytesToRead, r->fd);
+	STATS_READ(r, bytes_in, t);
 	if (bytes_in > 0)
 		clen = (uint32_t) bytes_in;
 	else
 		clen = 0;
 	r->pos += clen;
 
+	STATS_START(t);
 	lpcm_swap_samples(r->segmentSize, r->flags, buffer, buffer, n);
+	STATS_STOP(r, swapNanos, t);
 
 	return bytes_in;
 }
@@ -167,18 +172,23 @@ lpcm_seek(AIFF_Ref r, uint64_t pos)
 
 /*
  * Dequantize LPCM (buffer) to floating point PCM (samples)
+ *
+ * The samples are converted in increasing order, so 'buffer' may
+ * lie at the end of 'outSamples' (see lpcm_read_float32).
  */
 void
 lpcm_dequant(int segmentSize, void *buffer, float *outSamples, int nSamples)
 {
+	int i;
+
 	switch (segmentSize) {
 		case 4:
 		  {
 			  int32_t *integers = (int32_t *) buffer;
 			  
-			  while (nSamples-- > 0)
+			  for (i = 0; i < nSamples; ++i)
 				{
-				  outSamples[nSamples] = ldexp(integers[nSamples], -31);
+				  outSamples[i] = ldexp(integers[i], -31);
 				}
 			  break;
 		  }
@@ -191,7 +201,7 @@ lpcm_dequant(int segmentSize, void *buffer, float *outSamples, int nSamples)
 				uint8_t b[4];
 			  } u;
 			  
-			  while (nSamples-- > 0)
+			  for (i = 0; i < nSamples; ++i)
 				{
 #ifdef WORDS_BIGENDIAN
 				u.b[0] = (f[0] & 0x80 ? 0xff : 0);
@@ -214,9 +224,9 @@ lpcm_dequant(int segmentSize, void *buffer, float *outSamples, int nSamples)
 		  {
 			  int16_t *integers = (int16_t *) buffer;
 			  
-			  while (nSamples-- > 0)
+			  for (i = 0; i < nSamples; ++i)
 				{
-				  outSamples[nSamples] = ldexp(integers[nSamples], -15);
+				  outSamples[i] = ldexp(integers[i], -15);
 				}
 			  break;
 		  }
@@ -224,34 +234,53 @@ lpcm_dequant(int segmentSize, void *buffer, float *outSamples, int nSamples)
 		  {
 			  int8_t *integers = (int8_t *) buffer;
 			  
-			  while (nSamples-- > 0)
+			  for (i = 0; i < nSamples; ++i)
 				{
-				  outSamples[nSamples] = ldexp(integers[nSamples], -7);
+				  outSamples[i] = ldexp(integers[i], -7);
 				}
 			  break;
 		  }
 	}
 }
 			  
+/*
+ * Decode 'nSamples' raw segments as found on disk. 'raw' may
+ * lie at the end of 'outSamples'.
+ */
+static void
+lpcm_decode_float32(AIFF_Ref r, void *raw, float *outSamples, int nSamples)
+{
+	lpcm_swap_samples(r->segmentSize, r->flags, raw, raw, nSamples);
+	lpcm_dequant(r->segmentSize, raw, outSamples, nSamples);
+}
+
+/*
+ * The raw segments are read into the tail of the caller's buffer
+ * and dequantized in place: segment i always lies at or after
+ * float i, so no scratch buffer is needed.
+ */
 static int
 lpcm_read_float32(AIFF_Ref r, float *buffer, int nSamples)
 {
 	size_t len, slen, bytesToRead, bytes_in;
 	uint32_t clen;
 	int nSamplesRead;
-	void *buf;
+	uint8_t *buf;
+	STATS_TIMER(t)
 	
 	len = (size_t) nSamples * r->segmentSize;
 	slen = (size_t) (r->soundLen) - (size_t) (r->pos);
 	bytesToRead = MIN(len, slen);
+	bytesToRead -= bytesToRead % r->segmentSize;
 	if (bytesToRead == 0)
 		return 0;
 
-	buf = AIFFBufAllocate(r, kAIFFBufConv, bytesToRead);
-	if (NULL == buf)
-		return 0;
+	buf = (uint8_t *) buffer + 
+	    (bytesToRead / r->segmentSize) * sizeof(float) - bytesToRead;
 	
+	STATS_START(t);
 	bytes_in = fread(buf, 1, bytesToRead, r->fd);
+	STATS_READ(r, bytes_in, t);
 	if (bytes_in > 0)
 		clen = (uint32_t) bytes_in;
 	else
@@ -259,8 +288,13 @@ lpcm_read_float32(AIFF_Ref r, float *buffer, int nSamples)
 	r->pos += clen;
 	nSamplesRead = (int) clen / (r->segmentSize);
 	
+	/* lpcm_decode_float32(), timing each stage */
+	STATS_START(t);
 	lpcm_swap_samples(r->segmentSize, r->flags, buf, buf, nSamplesRead);
+	STATS_STOP(r, swapNanos, t);
+	STATS_START(t);
 	lpcm_dequant(r->segmentSize, buf, buffer, nSamplesRead);
+	STATS_STOP(r, convertNanos, t);
 	
 	return nSamplesRead;
 }
@@ -270,6 +304,7 @@ lpcm_write_lpcm(AIFF_Ref w, void *samples, size_t len, int readOnlyBuf)
 {
 	size_t   n, sampleBytes;
 	void 	*buffer;
+	STATS_TIMER(t)
 	
 	n = len;
 	if ((n % w->segmentSize) != 0)
@@ -283,11 +318,16 @@ lpcm_write_lpcm(AIFF_Ref w, void *samples, size_t len, int readOnlyBuf)
 		buffer = samples;
 	}
 
+	STATS_START(t);
 	lpcm_swap_samples(w->segmentSize, w->flags, samples, buffer, n);
+	STATS_STOP(w, swapNanos, t);
 
+	checksum_update(w, buffer, n * w->segmentSize);
+	STATS_START(t);
 	if (fwrite(buffer, w->segmentSize, n, w->fd) != n) {
 		return -1;
 	}
+	STATS_WRITE(w, n * w->segmentSize, t);
         
 	sampleBytes = n * w->segmentSize;
         
@@ -303,6 +343,7 @@ struct codec lpcm = {
 	NULL,
 	lpcm_read_lpcm,
 	lpcm_read_float32,
+	lpcm_decode_float32,
         lpcm_write_lpcm,
 	lpcm_seek,
 	NULL
@@ -0,0 +1,509 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Waveform overviews.
+ *
+ * For each level, the sound is cut into bins of a fixed number of
+ * sample frames and each bin keeps the minimum, maximum and RMS value
+ * of every channel. All the levels are made in one pass over the
+ * sound: the finest from the samples and each coarser one from the
+ * bins of the level below, when its bins are a multiple of those.
+ *
+ * An overview can be saved to a sidecar file, in host byte order:
+ *	"LAOV", version, channels, levels (uint32 each), frames (uint64);
+ *	then for each level
+ *	  frames per bin, 0 (uint32 each), bins, offset of the bins (uint64 each);
+ *	then the bins of each level, as arrays of AIFF_Bin, channels
+ *	interleaved.
+ * A loaded sidecar is mapped into memory where the system allows it,
+ * and the bins are read from there.
+ */
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#define OVERVIEW_MMAP 1
+#endif
+
+#define kOverviewMagic		"LAOV"
+#define kOverviewVersion	1
+#define kOverviewMaxLevels	32
+#define kOverviewBlock		4096	/* sample frames read at a time */
+
+struct s_OverviewAcc {
+	float           min;
+	float           max;
+	double          sumSq;
+};
+
+struct s_OverviewLevel {
+	unsigned int    binFrames;
+	uint64_t        nBins;
+	AIFF_Bin       *bins;
+	/* while building */
+	int             parent;	/* level fed with our bins, or -1 */
+	int             fromBins;	/* fed by the level below */
+	unsigned int    filled;	/* frames in the current bin */
+	struct s_OverviewAcc *acc;	/* one per channel */
+};
+
+struct s_AIFF_Overview {
+	int             nChannels;
+	int             nLevels;
+	uint64_t        nFrames;
+	struct s_OverviewLevel levels[kOverviewMaxLevels];
+	void           *map;	/* the sidecar, if loaded */
+	size_t          mapLen;
+	int             mapped;
+};
+
+/*
+ * Fold 'n' samples, 'stride' floats apart, into 'a'. Four independent
+ * accumulators, so the compiler can keep several reductions in flight
+ * (or in one vector register).
+ */
+static void
+overview_reduce(const float *p, int stride, unsigned int n, struct s_OverviewAcc *a)
+{
+	float           mn0, mn1, mn2, mn3, mx0, mx1, mx2, mx3, v0, v1, v2, v3;
+	double          s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	unsigned int    i;
+
+	mn0 = mn1 = mn2 = mn3 = a->min;
+	mx0 = mx1 = mx2 = mx3 = a->max;
+	for (i = 0; i + 4 <= n; i += 4, p += 4 * stride) {
+		v0 = p[0];
+		v1 = p[stride];
+		v2 = p[2 * stride];
+		v3 = p[3 * stride];
+		mn0 = (v0 < mn0 ? v0 : mn0);
+		mn1 = (v1 < mn1 ? v1 : mn1);
+		mn2 = (v2 < mn2 ? v2 : mn2);
+		mn3 = (v3 < mn3 ? v3 : mn3);
+		mx0 = (v0 > mx0 ? v0 : mx0);
+		mx1 = (v1 > mx1 ? v1 : mx1);
+		mx2 = (v2 > mx2 ? v2 : mx2);
+		mx3 = (v3 > mx3 ? v3 : mx3);
+		s0 += (double) v0 * v0;
+		s1 += (double) v1 * v1;
+		s2 += (double) v2 * v2;
+		s3 += (double) v3 * v3;
+	}
+	for (; i < n; i++, p += stride) {
+		v0 = p[0];
+		mn0 = (v0 < mn0 ? v0 : mn0);
+		mx0 = (v0 > mx0 ? v0 : mx0);
+		s0 += (double) v0 * v0;
+	}
+	mn0 = MIN(mn0, mn1);
+	mn2 = MIN(mn2, mn3);
+	mx0 = MAX(mx0, mx1);
+	mx2 = MAX(mx2, mx3);
+	a->min = MIN(mn0, mn2);
+	a->max = MAX(mx0, mx2);
+	a->sumSq += (s0 + s1) + (s2 + s3);
+}
+
+static void
+overview_reset(struct s_OverviewLevel *l, int nChannels)
+{
+	int             c;
+
+	for (c = 0; c < nChannels; c++) {
+		l->acc[c].min = HUGE_VAL;
+		l->acc[c].max = -HUGE_VAL;
+		l->acc[c].sumSq = 0;
+	}
+	l->filled = 0;
+}
+
+/*
+ * Close the current bin of level 'k', and pass it up.
+ */
+static void
+overview_emit(AIFF_OverviewRef o, int k)
+{
+	struct s_OverviewLevel *l = &o->levels[k], *up;
+	AIFF_Bin       *b;
+	unsigned int    filled;
+	int             c;
+
+	if (l->filled == 0)
+		return;
+	b = &l->bins[l->nBins * o->nChannels];
+	for (c = 0; c < o->nChannels; c++) {
+		b[c].min = l->acc[c].min;
+		b[c].max = l->acc[c].max;
+		b[c].rms = (float) sqrt(l->acc[c].sumSq / l->filled);
+	}
+	l->nBins++;
+	filled = l->filled;
+
+	if (l->parent >= 0) {
+		up = &o->levels[l->parent];
+		for (c = 0; c < o->nChannels; c++) {
+			up->acc[c].min = MIN(up->acc[c].min, l->acc[c].min);
+			up->acc[c].max = MAX(up->acc[c].max, l->acc[c].max);
+			up->acc[c].sumSq += l->acc[c].sumSq;
+		}
+		up->filled += filled;
+		if (up->filled == up->binFrames)
+			overview_emit(o, l->parent);
+	}
+	overview_reset(l, o->nChannels);
+}
+
+/*
+ * Feed 'n' frames to level 'k'.
+ */
+static void
+overview_feed(AIFF_OverviewRef o, int k, const float *frames, unsigned int n)
+{
+	struct s_OverviewLevel *l = &o->levels[k];
+	unsigned int    take;
+	int             c;
+
+	while (n > 0) {
+		take = MIN(n, l->binFrames - l->filled);
+		for (c = 0; c < o->nChannels; c++)
+			overview_reduce(frames + c, o->nChannels, take, &l->acc[c]);
+		l->filled += take;
+		frames += (size_t) take * o->nChannels;
+		n -= take;
+		if (l->filled == l->binFrames)
+			overview_emit(o, k);
+	}
+}
+
+static int
+overview_compare(const void *a, const void *b)
+{
+	unsigned int    x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static AIFF_OverviewRef
+overview_alloc(int nChannels, int nLevels)
+{
+	AIFF_OverviewRef o;
+
+	if ((o = malloc(sizeof(struct s_AIFF_Overview))) == NULL)
+		return (NULL);
+	memset(o, 0, sizeof(struct s_AIFF_Overview));
+	o->nChannels = nChannels;
+	o->nLevels = nLevels;
+
+	return (o);
+}
+
+void
+AIFF_OverviewDelete(AIFF_OverviewRef o)
+{
+	int             k;
+
+	if (o == NULL)
+		return;
+	if (o->map) {
+#ifdef OVERVIEW_MMAP
+		if (o->mapped)
+			munmap(o->map, o->mapLen);
+		else
+#endif
+			free(o->map);
+	} else {
+		for (k = 0; k < o->nLevels; k++) {
+			free(o->levels[k].bins);
+			free(o->levels[k].acc);
+		}
+	}
+	free(o);
+}
+
+/*
+ * Make the overview of the sound of 'r', with 'nLevels' levels of
+ * 'binFrames[i]' sample frames per bin. The levels are kept in
+ * increasing order of bin size. 'r' is read from the start
+ * (from where it is, if it is not seekable) to the end.
+ */
+AIFF_OverviewRef
+AIFF_OverviewCreate(AIFF_Ref r, const unsigned int *binFrames, int nLevels)
+{
+	AIFF_OverviewRef o;
+	struct s_OverviewLevel *l;
+	unsigned int    sizes[kOverviewMaxLevels];
+	float          *buf;
+	uint64_t        nBins;
+	int             k, j, n, ch;
+
+	if (!r || !(r->flags & F_RDONLY) || r->prefetch || r->resampler ||
+	    !binFrames || nLevels < 1 || nLevels > kOverviewMaxLevels)
+		return (NULL);
+	memcpy(sizes, binFrames, nLevels * sizeof(unsigned int));
+	qsort(sizes, nLevels, sizeof(unsigned int), overview_compare);
+	if (sizes[0] == 0)
+		return (NULL);
+	if (!(r->flags & F_NOTSEEKABLE) && AIFF_Seek(r, 0) < 0)
+		return (NULL);
+
+	ch = r->nChannels;
+	if ((o = overview_alloc(ch, nLevels)) == NULL)
+		return (NULL);
+	for (k = 0; k < nLevels; k++) {
+		l = &o->levels[k];
+		l->binFrames = sizes[k];
+		l->parent = -1;
+		nBins = (r->nSamples + sizes[k] - 1) / sizes[k];
+		l->bins = malloc((size_t) (nBins ? nBins : 1) * ch * sizeof(AIFF_Bin));
+		l->acc = malloc(ch * sizeof(struct s_OverviewAcc));
+		if (l->bins == NULL || l->acc == NULL)
+			goto fail;
+		overview_reset(l, ch);
+		/* fed by the finest level below that divides our bins */
+		for (j = k - 1; j >= 0 && !l->fromBins; j--) {
+			if (sizes[k] % sizes[j] == 0 && o->levels[j].parent < 0) {
+				o->levels[j].parent = k;
+				l->fromBins = 1;
+			}
+		}
+	}
+
+	if ((buf = malloc((size_t) kOverviewBlock * ch * sizeof(float))) == NULL)
+		goto fail;
+	while ((n = AIFF_ReadSamplesFloat(r, buf, kOverviewBlock * ch)) > 0) {
+		n /= ch;
+		if (o->nFrames + n > r->nSamples)
+			n = (int) (r->nSamples - o->nFrames);	/* keep to the bins we have */
+		if (n <= 0)
+			break;
+		for (k = 0; k < nLevels; k++) {
+			if (!o->levels[k].fromBins)
+				overview_feed(o, k, buf, (unsigned int) n);
+		}
+		o->nFrames += n;
+	}
+	free(buf);
+	if (n < 0)
+		goto fail;
+
+	/* the last, partial, bins */
+	for (k = 0; k < nLevels; k++)
+		overview_emit(o, k);
+	for (k = 0; k < nLevels; k++) {
+		free(o->levels[k].acc);
+		o->levels[k].acc = NULL;
+	}
+
+	return (o);
+
+fail:
+	AIFF_OverviewDelete(o);
+	return (NULL);
+}
+
+int
+AIFF_OverviewFormat(AIFF_OverviewRef o, int *nLevels, int *nChannels, uint64_t * nFrames)
+{
+	if (!o)
+		return (-1);
+	if (nLevels)
+		*nLevels = o->nLevels;
+	if (nChannels)
+		*nChannels = o->nChannels;
+	if (nFrames)
+		*nFrames = o->nFrames;
+	return (1);
+}
+
+/*
+ * Return the bins of level 'level' that cover 'nFrames' sample frames
+ * from 'startFrame' on, storing in '*binFrames' the frames per bin and
+ * in '*nBins' the number of bins returned (each one holds 'nChannels'
+ * AIFF_Bin). Return NULL if the range is empty or on error.
+ */
+const AIFF_Bin *
+AIFF_OverviewBins(AIFF_OverviewRef o, int level, uint64_t startFrame,
+    uint64_t nFrames, unsigned int *binFrames, uint64_t * nBins)
+{
+	struct s_OverviewLevel *l;
+	uint64_t        first, last, end;
+
+	if (nBins)
+		*nBins = 0;
+	if (!o || level < 0 || level >= o->nLevels)
+		return (NULL);
+	l = &o->levels[level];
+	if (binFrames)
+		*binFrames = l->binFrames;
+	if (startFrame >= o->nFrames || nFrames == 0)
+		return (NULL);
+
+	end = (nFrames > o->nFrames - startFrame ? o->nFrames : startFrame + nFrames);
+	first = startFrame / l->binFrames;
+	last = MIN((end + l->binFrames - 1) / l->binFrames, l->nBins);
+	if (nBins)
+		*nBins = last - first;
+
+	return (l->bins + first * o->nChannels);
+}
+
+static int
+put32(FILE * f, uint32_t v)
+{
+	return (fwrite(&v, 4, 1, f) == 1);
+}
+
+static int
+put64(FILE * f, uint64_t v)
+{
+	return (fwrite(&v, 8, 1, f) == 1);
+}
+
+/*
+ * Save the overview to the sidecar file 'file'.
+ */
+int
+AIFF_OverviewSave(AIFF_OverviewRef o, const char *file)
+{
+	FILE           *f;
+	uint64_t        offset;
+	size_t          n;
+	int             k, ok;
+
+	if (!o || !file)
+		return (-1);
+	if ((f = fopen(file, "wb")) == NULL)
+		return (-1);
+
+	ok = fwrite(kOverviewMagic, 1, 4, f) == 4 && put32(f, kOverviewVersion) &&
+	    put32(f, (uint32_t) o->nChannels) && put32(f, (uint32_t) o->nLevels) &&
+	    put64(f, o->nFrames);
+	offset = 24 + 24 * (uint64_t) o->nLevels;
+	for (k = 0; ok && k < o->nLevels; k++) {
+		ok = put32(f, o->levels[k].binFrames) && put32(f, 0) &&
+		    put64(f, o->levels[k].nBins) && put64(f, offset);
+		offset += o->levels[k].nBins * o->nChannels * sizeof(AIFF_Bin);
+	}
+	for (k = 0; ok && k < o->nLevels; k++) {
+		n = (size_t) o->levels[k].nBins * o->nChannels;
+		ok = fwrite(o->levels[k].bins, sizeof(AIFF_Bin), n, f) == n;
+	}
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok) {
+		remove(file);
+		return (-1);
+	}
+
+	return (1);
+}
+
+/*
+ * Load an overview from the sidecar file 'file'.
+ */
+AIFF_OverviewRef
+AIFF_OverviewLoad(const char *file)
+{
+	AIFF_OverviewRef o = NULL;
+	FILE           *f;
+	uint8_t        *p, *map = NULL;
+	uint32_t        v[4], lv[2];
+	uint64_t        nFrames, nBins, offset, need;
+	long            len;
+	int             k, mapped = 0;
+
+	if (!file || (f = fopen(file, "rb")) == NULL)
+		return (NULL);
+	if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 24 ||
+	    fseek(f, 0, SEEK_SET) < 0)
+		goto out;
+
+#ifdef OVERVIEW_MMAP
+	map = mmap(NULL, (size_t) len, PROT_READ, MAP_SHARED, fileno(f), 0);
+	if (map == MAP_FAILED)
+		map = NULL;
+	else
+		mapped = 1;
+#endif
+	if (map == NULL) {
+		if ((map = malloc((size_t) len)) == NULL ||
+		    fread(map, 1, (size_t) len, f) != (size_t) len) {
+			free(map);
+			goto out;
+		}
+	}
+
+	memcpy(v, map, 16);
+	memcpy(&nFrames, map + 16, 8);
+	if (memcmp(map, kOverviewMagic, 4) != 0 || v[1] != kOverviewVersion ||
+	    v[2] < 1 || v[3] < 1 || v[3] > kOverviewMaxLevels ||
+	    24 + 24 * (uint64_t) v[3] > (uint64_t) len ||
+	    (o = overview_alloc((int) v[2], (int) v[3])) == NULL)
+		goto bad;
+	o->nFrames = nFrames;
+	for (k = 0, p = map + 24; k < o->nLevels; k++, p += 24) {
+		memcpy(lv, p, 8);
+		memcpy(&nBins, p + 8, 8);
+		memcpy(&offset, p + 16, 8);
+		need = nBins * o->nChannels * sizeof(AIFF_Bin);
+		if (lv[0] == 0 || offset % 4 != 0 || offset > (uint64_t) len ||
+		    need / sizeof(AIFF_Bin) / o->nChannels != nBins ||
+		    need > (uint64_t) len - offset ||
+		    nBins < (nFrames + lv[0] - 1) / lv[0])
+			goto bad;
+		o->levels[k].binFrames = lv[0];
+		o->levels[k].nBins = nBins;
+		o->levels[k].bins = (AIFF_Bin *) (void *) (map + offset);
+	}
+	o->map = map;
+	o->mapLen = (size_t) len;
+	o->mapped = mapped;
+	goto out;
+
+bad:
+	free(o);
+	o = NULL;
+#ifdef OVERVIEW_MMAP
+	if (mapped)
+		munmap(map, (size_t) len);
+	else
+#endif
+		free(map);
+out:
+	fclose(f);
+	return (o);
+}
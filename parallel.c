@@ -0,0 +1,194 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Parallel decoding of a range of sample frames.
+ *
+ * Every frame lies at a known offset of the file, so the range is
+ * cut in as many spans as threads and each thread reads its span
+ * with positional reads and decodes it. The raw bytes are read
+ * into the tail of each piece of the output and decoded in place,
+ * so the threads need no memory of their own.
+ */
+
+#ifdef AIFF_PREAD
+
+#include <unistd.h>
+#ifdef AIFF_THREADS
+#include <pthread.h>
+#endif
+
+#define kDecodeChunk	65536	/* sample frames per read */
+#define kDecodeMaxThreads	64
+
+#ifdef AIFF_THREADS
+struct s_DecodeSpan {
+	AIFF_Ref        r;
+	uint64_t        frame;
+	uint64_t        nFrames;
+	float          *out;
+	int             res;
+	pthread_t       thread;
+};
+#endif
+
+static int
+decode_span(AIFF_Ref r, uint64_t frame, uint64_t nFrames, float *out)
+{
+	int             fd = fileno(r->fd);
+	int             fs = AIFFFrameSize(r);
+	unsigned int    n;
+	size_t          bytes;
+	uint8_t        *raw;
+
+	while (nFrames > 0) {
+		n = (unsigned int) MIN(nFrames, kDecodeChunk);
+		bytes = (size_t) n * fs;
+		raw = (uint8_t *) out + (size_t) n * r->nChannels * sizeof(float) - bytes;
+		if (engine_pread(fd, raw, bytes, r->dataOffset + frame * fs) != (long) bytes)
+			return (-1);
+		r->codec->decode_float32(r, raw, out, (int) n * r->nChannels);
+
+		out += (size_t) n * r->nChannels;
+		frame += n;
+		nFrames -= n;
+	}
+
+	return (1);
+}
+
+#ifdef AIFF_THREADS
+static void    *
+decode_worker(void *arg)
+{
+	struct s_DecodeSpan *d = arg;
+
+	d->res = decode_span(d->r, d->frame, d->nFrames, d->out);
+	return (NULL);
+}
+#endif
+
+/*
+ * Decode 'nFrames' sample frames from frame 'start' on into 'out'
+ * using 'nThreads' threads (0 for one per processor). Return the
+ * number of sample frames decoded (less than 'nFrames' if the sound
+ * ends before), or -1 on error.
+ */
+int64_t
+AIFF_DecodeRangeParallel(AIFF_Ref r, uint64_t start, uint64_t nFrames,
+    float *out, int nThreads)
+{
+	uint64_t        avail;
+#ifdef AIFF_THREADS
+	struct s_DecodeSpan span[kDecodeMaxThreads];
+	uint64_t        per, frame;
+	int             i, started;
+#endif
+
+	if (!r || !out || !(r->flags & F_RDONLY) || (r->flags & F_NOTSEEKABLE))
+		return (-1);
+	if (AIFFPrepare(r) < 1)
+		return (-1);
+	avail = MIN(r->nSamples, r->soundLen / AIFFFrameSize(r));
+	if (start >= avail || nFrames == 0)
+		return (0);
+	nFrames = MIN(nFrames, avail - start);
+
+	if (nThreads < 1) {
+#ifdef _SC_NPROCESSORS_ONLN
+		nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (nThreads < 1)
+			nThreads = 1;
+	}
+	nThreads = MIN(nThreads, kDecodeMaxThreads);
+#ifndef AIFF_THREADS
+	nThreads = 1;
+#endif
+	if ((uint64_t) nThreads > (nFrames + kDecodeChunk - 1) / kDecodeChunk)
+		nThreads = (int) ((nFrames + kDecodeChunk - 1) / kDecodeChunk);
+	if (nThreads < 2)
+		return (decode_span(r, start, nFrames, out) < 1 ? -1 : (int64_t) nFrames);
+
+#ifdef AIFF_THREADS
+	per = nFrames / nThreads;
+	frame = 0;
+	for (i = 0; i < nThreads; i++) {
+		span[i].r = r;
+		span[i].frame = start + frame;
+		span[i].nFrames = (i == nThreads - 1 ? nFrames - frame : per);
+		span[i].out = out + frame * r->nChannels;
+		frame += span[i].nFrames;
+	}
+
+	for (i = 1; i < nThreads; i++) {
+		if (pthread_create(&span[i].thread, NULL, decode_worker, &span[i]) != 0)
+			break;
+	}
+	started = i;
+	span[0].res = decode_span(r, span[0].frame, span[0].nFrames, span[0].out);
+	for (i = started; i < nThreads; i++) {
+		/* No thread for these */
+		span[i].res = decode_span(r, span[i].frame, span[i].nFrames, span[i].out);
+	}
+	for (i = 1; i < started; i++)
+		pthread_join(span[i].thread, NULL);
+
+	for (i = 0; i < nThreads; i++) {
+		if (span[i].res < 1)
+			return (-1);
+	}
+#endif /* AIFF_THREADS */
+
+	return ((int64_t) nFrames);
+}
+
+#else /* !AIFF_PREAD */
+
+int64_t
+AIFF_DecodeRangeParallel(AIFF_Ref r, uint64_t start, uint64_t nFrames,
+    float *out, int nThreads)
+{
+	(void) r;
+	(void) start;
+	(void) nFrames;
+	(void) out;
+	(void) nThreads;
+	return (-1);
+}
+
+#endif /* AIFF_PREAD */
@@ -0,0 +1,281 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Asynchronous read-ahead.
+ *
+ * A worker thread decodes the sound into a frame ring (see ring.c)
+ * while the reader drains it. The worker is the only one touching
+ * the file and the codec; the reader never blocks nor allocates,
+ * so it can be used from a real-time audio callback.
+ *
+ * When the ring is full the worker sleeps on the 'wake' semaphore
+ * after raising 'waiting'; the reader only posts the semaphore if
+ * it finds 'waiting' raised, so it does no system call while the
+ * worker is busy.
+ */
+
+#ifdef AIFF_THREADS
+
+#include <pthread.h>
+#include <semaphore.h>
+
+struct s_AIFF_Prefetch {
+	pthread_t       thread;
+	sem_t           wake;
+	int             running;
+	int             quit;
+	int             waiting;
+	AIFF_RingRef    ring;
+	unsigned int    blockFrames;
+	uint64_t        frame;	/* sample frame where the worker started */
+	uint64_t        consumed;	/* sample frames read since 'frame' */
+	uint64_t        underruns;
+};
+
+static void    *
+prefetch_worker(void *arg)
+{
+	AIFF_Ref        r = arg;
+	struct s_AIFF_Prefetch *p = r->prefetch;
+
+	while (!ATOMIC_LOAD(&p->quit)) {
+		if (AIFF_RingWritable(p->ring) < p->blockFrames) {
+			ATOMIC_EXCHANGE(&p->waiting, 1);
+			if (AIFF_RingWritable(p->ring) < p->blockFrames ||
+			    ATOMIC_EXCHANGE(&p->waiting, 0) == 0) {
+				while (sem_wait(&p->wake) != 0)
+					continue;
+			}
+			continue;
+		}
+		if (ring_fill(r, p->ring, p->blockFrames) < 1)
+			break;	/* end of sound or error */
+	}
+
+	return (NULL);
+}
+
+static int
+prefetch_spawn(AIFF_Ref r, uint64_t frame)
+{
+	struct s_AIFF_Prefetch *p = r->prefetch;
+
+	AIFF_RingReset(p->ring);
+	p->quit = 0;
+	p->waiting = 0;
+	p->frame = frame;
+	p->consumed = 0;
+	if (sem_init(&p->wake, 0, 0) != 0)
+		return (-1);
+	if (pthread_create(&p->thread, NULL, prefetch_worker, r) != 0) {
+		sem_destroy(&p->wake);
+		return (-1);
+	}
+	p->running = 1;
+
+	return (1);
+}
+
+int
+prefetch_start(AIFF_Ref r, int nBlocks, int blockFrames, uint64_t frame)
+{
+	struct s_AIFF_Prefetch *p;
+
+	if (nBlocks < 2 || blockFrames < 1)
+		return (0);
+	if ((p = malloc(sizeof(struct s_AIFF_Prefetch))) == NULL)
+		return (-1);
+	p->ring = AIFF_RingCreate(r, (unsigned int) nBlocks * blockFrames, kRingFloat);
+	if (p->ring == NULL) {
+		free(p);
+		return (-1);
+	}
+	p->blockFrames = blockFrames;
+	p->underruns = 0;
+	p->running = 0;
+	r->prefetch = p;
+
+	if (prefetch_spawn(r, frame) < 1) {
+		prefetch_destroy(r, NULL);
+		return (-1);
+	}
+
+	return (1);
+}
+
+/*
+ * Stop the worker. The file position is left wherever
+ * the worker left it.
+ */
+void
+prefetch_pause(AIFF_Ref r)
+{
+	struct s_AIFF_Prefetch *p = r->prefetch;
+
+	if (!p->running)
+		return;
+	ATOMIC_STORE(&p->quit, 1);
+	sem_post(&p->wake);
+	pthread_join(p->thread, NULL);
+	sem_destroy(&p->wake);
+	p->running = 0;
+}
+
+/*
+ * Restart the worker, reading from the current file position
+ * (which must correspond to sample frame 'frame').
+ */
+int
+prefetch_resume(AIFF_Ref r, uint64_t frame)
+{
+	ASSERT(!r->prefetch->running);
+
+	return (prefetch_spawn(r, frame));
+}
+
+/*
+ * Tear down the read-ahead. If 'frame' is not NULL, store there
+ * the sample frame the reader is positioned at.
+ */
+void
+prefetch_destroy(AIFF_Ref r, uint64_t *frame)
+{
+	struct s_AIFF_Prefetch *p = r->prefetch;
+
+	if (p == NULL)
+		return;
+	prefetch_pause(r);
+	if (frame)
+		*frame = p->frame + p->consumed;
+
+	AIFF_RingDelete(p->ring);
+	free(p);
+	r->prefetch = NULL;
+}
+
+/*
+ * Reader side. Never blocks: if the worker is late, the rest
+ * of the buffer is filled with silence and an underrun is counted.
+ */
+int
+prefetch_read_float32(AIFF_Ref r, float *buffer, int nSamplePoints)
+{
+	struct s_AIFF_Prefetch *p = r->prefetch;
+	unsigned int    want, got;
+	int             n, ended;
+
+	want = nSamplePoints / r->nChannels;
+	got = AIFF_RingRead(p->ring, buffer, want);
+	p->consumed += got;
+
+	if (got > 0) {
+		ATOMIC_FENCE();
+		if (ATOMIC_LOAD(&p->waiting) && ATOMIC_EXCHANGE(&p->waiting, 0))
+			sem_post(&p->wake);
+	}
+	n = got * r->nChannels;
+
+	if (got < want) {
+		if ((ended = AIFF_RingEnded(p->ring)) != 0) {
+			/* End of sound (or error) */
+			return (ended < 0 && n == 0 ? -1 : n);
+		}
+		/* Worker is late: underrun */
+		memset(buffer + n, 0, (size_t) (nSamplePoints - n) * sizeof(float));
+		p->underruns++;
+		n = nSamplePoints;
+	}
+
+	return (n);
+}
+
+uint64_t
+prefetch_underruns(AIFF_Ref r)
+{
+	return (r->prefetch->underruns);
+}
+
+#else /* !AIFF_THREADS */
+
+int
+prefetch_start(AIFF_Ref r, int nBlocks, int blockFrames, uint64_t frame)
+{
+	(void) r;
+	(void) nBlocks;
+	(void) blockFrames;
+	(void) frame;
+	return (-1);
+}
+
+void
+prefetch_pause(AIFF_Ref r)
+{
+	(void) r;
+}
+
+int
+prefetch_resume(AIFF_Ref r, uint64_t frame)
+{
+	(void) r;
+	(void) frame;
+	return (-1);
+}
+
+void
+prefetch_destroy(AIFF_Ref r, uint64_t *frame)
+{
+	(void) r;
+	(void) frame;
+}
+
+int
+prefetch_read_float32(AIFF_Ref r, float *buffer, int nSamplePoints)
+{
+	(void) r;
+	(void) buffer;
+	(void) nSamplePoints;
+	return (-1);
+}
+
+uint64_t
+prefetch_underruns(AIFF_Ref r)
+{
+	(void) r;
+	return (0);
+}
+
+#endif /* AIFF_THREADS */
@@ -4,11 +4,17 @@
 #define OFF_T off_t
 #define FSEEKO fseeko
 
+/* I/O instrumentation, see stats.c */
+#ifdef ENABLE_STATS
+#define AIFF_STATS 1
+#endif
+
 struct codec {
 	IFFType         fmt;
 	int             (*construct) (AIFF_Ref);
         size_t		(*read_lpcm) (AIFF_Ref, void *, size_t);
 	int             (*read_float32) (AIFF_Ref, float *, int);
+	void            (*decode_float32) (AIFF_Ref, void *, float *, int);
         int             (*write_lpcm) (AIFF_Ref, void *, size_t, int);
 	int             (*seek) (AIFF_Ref, uint64_t);
 	void            (*destroy) (AIFF_Ref);
@@ -43,11 +49,30 @@ struct s_AIFF_Rec {
 	uint64_t commonOffset;
 	uint64_t soundOffset;
 	uint64_t markerOffset;
+	uint64_t dataOffset; /* file offset of the first sample */
 	IFFType format;
 	IFFType audioFormat;
 	struct codec *codec;
 	void* pdata;
 	AIFF_Buf buf[kAIFFNBufs];
+	struct s_AIFF_Prefetch *prefetch;
+	struct s_AIFF_Spool *spool;
+	struct s_IFFChunkEntry *chunks; /* chunk table, or NULL */
+	int nChunks;
+	struct s_AIFF_MarkerIndex *markerIndex;
+	uint8_t *trailer; /* chunks to put back after the sound (F_APPEND) */
+	uint32_t trailerLen;
+	uint64_t oldEnd; /* end of the last chunk when reopened (F_APPEND) */
+	struct s_AIFF_Checkpoint *checkpoint;
+	struct s_AIFF_Checksum *checksum; /* see AIFF_StartChecksum */
+	struct s_AIFF_Resampler *resampler; /* see AIFF_SetOutputRate */
+	struct s_AIFF_Dither *dither; /* see AIFF_SetDither */
+#ifdef AIFF_STATS
+	AIFF_IOStats stats; /* see AIFF_GetStats */
+#endif
+	AIFF_Marker *queued; /* markers to write, see AIFFQueueMarker */
+	size_t nQueued;
+	size_t maxQueued;
 } ;
 #define kAIFFRecSize	sizeof(struct s_AIFF_Rec)
 
@@ -68,6 +93,77 @@ struct s_AIFF_Rec {
 #undef MIN
 #endif
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
+#ifdef MAX
+#undef MAX
+#endif
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+/*
+ * The threaded I/O modes need POSIX threads & semaphores
+ * and the compiler atomic builtins.
+ */
+#if defined(HAVE_PTHREAD) && defined(HAVE_PTHREAD_H) && \
+    defined(HAVE_SEMAPHORE_H) && defined(HAVE_ATOMIC_BUILTINS)
+#define AIFF_THREADS 1
+#endif
+
+/*
+ * Positional reads, which do not move the stream position.
+ */
+#if defined(HAVE_PREAD) && defined(HAVE_UNISTD_H)
+#define AIFF_PREAD 1
+#endif
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define ATOMIC_LOAD(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ATOMIC_EXCHANGE(p, v)	__atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_FETCH_ADD(p, v)	__atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_FENCE()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+/* XXX -- the lock-free structures are only usable from one thread. */
+#define ATOMIC_LOAD(p)		(*(p))
+#define ATOMIC_STORE(p, v)	(*(p) = (v))
+#define ATOMIC_FENCE()
+#endif
+
+/*
+ * I/O instrumentation. Without --enable-stats the
+ * counters and the clock readings compile to nothing.
+ * STATS_TIMER declares a variable: put it last in the
+ * declarations, without a semicolon.
+ */
+#ifdef AIFF_STATS
+#define STATS_TIMER(t)		uint64_t t;
+#define STATS_RESET(r)		memset(&(r)->stats, 0, sizeof(AIFF_IOStats))
+#define STATS_ADD(r, f, n)	((r)->stats.f += (uint64_t) (n))
+#define STATS_START(t)		((t) = stats_clock())
+#define STATS_STOP(r, f, t)	((r)->stats.f += stats_clock() - (t))
+#define STATS_READ(r, n, t)	(STATS_STOP(r, ioNanos, t), \
+				 (r)->stats.readCalls++, STATS_ADD(r, bytesRead, n))
+#define STATS_WRITE(r, n, t)	(STATS_STOP(r, ioNanos, t), \
+				 (r)->stats.writeCalls++, STATS_ADD(r, bytesWritten, n))
+#define STATS_MERGE(r)		stats_merge(r)
+#else
+#define STATS_TIMER(t)
+#define STATS_RESET(r)		((void) 0)
+#define STATS_ADD(r, f, n)	((void) 0)
+#define STATS_START(t)		((void) 0)
+#define STATS_STOP(r, f, t)	((void) 0)
+#define STATS_READ(r, n, t)	((void) 0)
+#define STATS_WRITE(r, n, t)	((void) 0)
+#define STATS_MERGE(r)		((void) 0)
+#endif
+
+/*
+ * Tracing hooks. While no callback is set they cost
+ * a load and a branch; the arguments of TRACE_END are
+ * only evaluated when tracing.
+ */
+#define TRACE_BEGIN(r, op)	(trace_hook ? \
+				 trace_event((r), (op), kTraceBegin, 0) : (void) 0)
+#define TRACE_END(r, op, n)	(trace_hook ? \
+				 trace_event((r), (op), kTraceEnd, (uint64_t) (n)) : (void) 0)
 
 #ifdef ASSERT
 #undef ASSERT
@@ -82,6 +178,8 @@ void            AIFFAssertionFailed(const char *, int);
 #define F_IEEE754_NATIVE	(1 << 28)
 #define SSND_REACHED		(1 << 29)
 
+#define IFF_FILLER	0x20202020	/* '    ', the IFF filler chunk */
+
 
 /* == Supported formats == */
 
@@ -180,9 +278,61 @@ struct s_AIFFComment {
 typedef struct s_AIFFComment CommentChunk;
 
 
+/*
+ * The sound format, as found on the COMM chunk.
+ */
+struct s_AIFXFormat {
+	uint64_t        nSamples;
+	int             nChannels;
+	double          samplingRate;
+	int             bitsPerSample;
+	int             segmentSize;
+	IFFType         audioFormat;
+	int             flags;	/* LPCM_BIG_ENDIAN or LPCM_LTE_ENDIAN */
+};
+typedef struct s_AIFXFormat AIFXFormat;
+
+/*
+ * An entry of the chunk table of a file being read.
+ */
+struct s_IFFChunkEntry {
+	IFFType         id;	/* in host byte order */
+	uint32_t        len;
+	uint64_t        offset;	/* file offset of the chunk data */
+};
+typedef struct s_IFFChunkEntry IFFChunkEntry;
+
+/*
+ * What a read reference learns from the header of a file.
+ */
+struct s_AIFFIndex {
+	IFFType         format;
+	AIFXFormat      common;
+	IFFChunkEntry  *chunks;
+	int             nChunks;
+};
+typedef struct s_AIFFIndex AIFFIndex;
+
+/*
+ * The markers of a file being read, built on first use.
+ */
+struct s_AIFF_MarkerIndex {
+	AIFF_MarkerList *list;	/* NULL if there are no markers */
+	AIFF_Marker    *markers;	/* sorted by position */
+	size_t          nMarkers;
+	int            *byId;	/* index in 'markers' by MarkerId, or -1 */
+	int             maxId;
+	AIFF_CommentList *comments;	/* sorted by marker, or NULL */
+};
+
+
 /* iff.c */
 int 
+index_iff_chunks(AIFF_Ref);
+int 
 find_iff_chunk(IFFType, AIFF_Ref, uint32_t *);
+int 
+replace_iff_chunk(AIFF_Ref, IFFType, const uint8_t *, uint32_t);
 char           *
 get_iff_attribute(AIFF_Ref r, IFFType attrib);
 int 
@@ -192,10 +342,24 @@ clone_iff_attributes(AIFF_Ref w, AIFF_Ref r);
 
 /* aifx.c */
 int 
+check_aifx_common(const AIFXFormat *);
+int 
+parse_aifx_common(const uint8_t *, uint32_t, IFFType, AIFXFormat *);
+int 
 init_aifx(AIFF_Ref);
 int 
 read_aifx_marker(AIFF_Ref r, int *id, uint64_t * position, char **name);
 int 
+read_aifx_markers(AIFF_Ref r, AIFF_MarkerList **list);
+int 
+read_aifx_comments(AIFF_Ref r, AIFF_CommentList **list);
+uint32_t 
+last_aifx_marker_id(const AIFF_Marker *, size_t);
+uint8_t        *
+build_aifx_markers(const AIFF_Marker *, size_t, uint32_t *);
+uint8_t        *
+build_aifx_comments(const AIFF_Comment *, size_t, uint32_t *);
+int 
 get_aifx_instrument(AIFF_Ref r, Instrument * inpi);
 int 
 do_aifx_prepare(AIFF_Ref r);
@@ -210,6 +374,7 @@ void            lpcm_dequant(int segmentSize, void *buffer, float *outFrames, in
 extern struct codec lpcm;
 
 /* g711.c */
+void            g711_table(IFFType, int16_t *);
 extern struct codec ulaw;
 extern struct codec alaw;
 
@@ -226,7 +391,58 @@ char           *PASCALInRead(FILE *, int *);
 int             PASCALOutGetLength(const char *);
 int             PASCALOutWrite(FILE *, const char *);
 
+/* ring.c */
+int             ring_fill(AIFF_Ref, AIFF_RingRef, unsigned int);
+
+/* prefetch.c */
+int             prefetch_start(AIFF_Ref, int, int, uint64_t);
+void            prefetch_pause(AIFF_Ref);
+int             prefetch_resume(AIFF_Ref, uint64_t);
+void            prefetch_destroy(AIFF_Ref, uint64_t *);
+int             prefetch_read_float32(AIFF_Ref, float *, int);
+uint64_t        prefetch_underruns(AIFF_Ref);
+
+/* engine.c */
+long            engine_pread(int, void *, size_t, uint64_t);
+
+/* spool.c */
+int             spool_start(AIFF_Ref, int, int);
+int             spool_write(AIFF_Ref, void *, size_t, int);
+int             spool_finish(AIFF_Ref);
+void            spool_stats(AIFF_Ref, unsigned int *, uint64_t *);
+
+/* checkpoint.c */
+int             checkpoint_update(AIFF_Ref);
+void            checkpoint_destroy(AIFF_Ref);
+
+/* checksum.c */
+void            checksum_update(AIFF_Ref, const void *, size_t);
+void            checksum_destroy(AIFF_Ref);
+
+/* quantize.c */
+void            dither_destroy(AIFF_Ref);
+
+/* resample.c */
+int             resample_read(AIFF_Ref, float *, int);
+int             resample_seek(AIFF_Ref, uint64_t);
+void            resample_destroy(AIFF_Ref);
+
+/* stats.c */
+uint64_t        stats_clock(void);
+void            stats_merge(AIFF_Ref);
+
+/* trace.c */
+extern struct s_TraceHook *trace_hook;
+void            trace_event(AIFF_Ref, int, int, uint64_t);
+
 /* libaiff.c */
+AIFF_Ref	 AIFFReadOpenStream(FILE *, int, AIFFIndex *);
+int		 AIFFPrepare(AIFF_Ref);
+int		 AIFFFrameSize(AIFF_Ref);
+int		 AIFFReadFloat(AIFF_Ref, float *, int);
+int		 AIFFSeek(AIFF_Ref, uint64_t);
+int		 AIFFWriteSamples(AIFF_Ref, void *, size_t, int);
 void		 AIFFBufDelete(AIFF_Ref, int);
 void		*AIFFBufAllocate(AIFF_Ref, int, unsigned int);
+int		 AIFFQueueMarker(AIFF_Ref, uint64_t, const char *);
 
@@ -0,0 +1,301 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include <libaiff/endian.h>
+#include "private.h"
+
+/*
+ * Header-only probing.
+ *
+ * The first kProbeSize bytes of the file are read at once into
+ * a buffer on the stack and the chunks are walked from there.
+ * Only the chunks lying beyond that block (typically the markers
+ * after a long SSND) cost an extra small read. Nothing is allocated.
+ */
+
+#if defined(AIFF_PREAD) && defined(HAVE_FCNTL_H)
+#include <unistd.h>
+#include <fcntl.h>
+#define PROBE_POSIX 1
+#endif
+#ifdef AIFF_THREADS
+#include <pthread.h>
+#endif
+
+#define kProbeSize		4096
+#define kProbeBatch		32	/* paths taken at a time by a thread */
+#define kProbeMaxThreads	64
+
+struct s_Probe {
+#ifdef PROBE_POSIX
+	int             fd;
+#else
+	FILE           *fp;
+#endif
+	size_t          len;
+	uint8_t         buf[kProbeSize];
+};
+
+/*
+ * Return 'n' bytes at 'offset', from the first block if they
+ * are in it or else read into 'tmp'.
+ */
+static const uint8_t *
+probe_at(struct s_Probe *p, uint64_t offset, size_t n, uint8_t *tmp)
+{
+	if (offset + n <= p->len)
+		return (p->buf + offset);
+#ifdef PROBE_POSIX
+	if (engine_pread(p->fd, tmp, n, offset) != (long) n)
+		return (NULL);
+#else
+	if (fseek(p->fp, (long) offset, SEEK_SET) < 0 ||
+	    fread(tmp, 1, n, p->fp) != n)
+		return (NULL);
+#endif
+	return (tmp);
+}
+
+static int
+probe_parse(struct s_Probe *p, AIFF_Info * info)
+{
+	const uint8_t  *b;
+	uint8_t         tmp[22];
+	IFFType         hid, fid;
+	uint32_t        id, len, n, offset;
+	uint64_t        of, end;
+	AIFXFormat      f;
+	int             common = 0;
+
+	if (p->len < 12)
+		return (0);
+	memcpy(&hid, p->buf, 4);
+	memcpy(&len, p->buf + 4, 4);
+	memcpy(&fid, p->buf + 8, 4);
+	if (hid != AIFF_TYPE_IFF)
+		return (0);
+	if (fid != AIFF_TYPE_AIFF && fid != AIFF_TYPE_AIFC)
+		return (0);
+
+	memset(info, 0, sizeof(AIFF_Info));
+	if (fid == AIFF_TYPE_AIFC)
+		info->flags |= F_AIFC;
+	end = (uint64_t) ARRANGE_BE32(len) + 8;
+
+	for (of = 12; of + 8 <= end; of += 8 + len + (len & 1)) {
+		if ((b = probe_at(p, of, 8, tmp)) == NULL)
+			break;	/* truncated */
+		memcpy(&id, b, 4);
+		memcpy(&len, b + 4, 4);
+		id = ARRANGE_BE32(id);
+		len = ARRANGE_BE32(len);
+
+		switch (id) {
+		case AIFF_COMM:
+			if (len < 18)
+				return (0);
+			n = (len >= 22 && fid == AIFF_TYPE_AIFC ? 22 : 18);
+			if ((b = probe_at(p, of + 8, n, tmp)) == NULL)
+				return (-1);
+			if (!parse_aifx_common(b, len, fid, &f))
+				return (0);
+			info->encoding = f.audioFormat;
+			info->flags |= f.flags;
+			info->channels = f.nChannels;
+			info->bitsPerSample = f.bitsPerSample;
+			info->segmentSize = f.segmentSize;
+			info->samplingRate = f.samplingRate;
+			info->nSamples = f.nSamples;
+			common = 1;
+			break;
+		case AIFF_SSND:
+			if (len < 8)
+				return (0);
+			if ((b = probe_at(p, of + 8, 4, tmp)) == NULL)
+				return (-1);
+			memcpy(&offset, b, 4);
+			offset = ARRANGE_BE32(offset);
+			if (offset > len - 8)
+				return (0);
+			info->soundOffset = of + 16 + offset;
+			info->soundLength = len - 8 - offset;
+			break;
+		case AIFF_NAME:
+			info->chunks |= kInfoName;
+			break;
+		case AIFF_AUTH:
+			info->chunks |= kInfoAuth;
+			break;
+		case AIFF_COPY:
+			info->chunks |= kInfoCopy;
+			break;
+		case AIFF_ANNO:
+			info->chunks |= kInfoAnno;
+			break;
+		case AIFF_MARK:
+			info->chunks |= kInfoMarkers;
+			break;
+		case AIFF_INST:
+			info->chunks |= kInfoInstrument;
+			break;
+		case AIFF_COMT:
+			info->chunks |= kInfoComments;
+			break;
+		}
+	}
+
+	return (common);
+}
+
+/*
+ * Return 1 if 'path' is an AIFF or AIFF-C file (and fill 'info'),
+ * 0 if it is not, -1 if it could not be read.
+ */
+int
+AIFF_Probe(const char *path, AIFF_Info * info)
+{
+	struct s_Probe  p;
+	int             res;
+#ifdef PROBE_POSIX
+	long            n;
+
+	if (!path || !info)
+		return (-1);
+	if ((p.fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	if ((n = engine_pread(p.fd, p.buf, kProbeSize, 0)) < 0) {
+		close(p.fd);
+		return (-1);
+	}
+	p.len = (size_t) n;
+	res = probe_parse(&p, info);
+	close(p.fd);
+#else
+	if (!path || !info)
+		return (-1);
+	if ((p.fp = fopen(path, "rb")) == NULL)
+		return (-1);
+	setvbuf(p.fp, NULL, _IONBF, 0);
+	p.len = fread(p.buf, 1, kProbeSize, p.fp);
+	res = probe_parse(&p, info);
+	fclose(p.fp);
+#endif
+
+	return (res);
+}
+
+struct s_ProbeBatch {
+	const char    **paths;
+	AIFF_Info      *infos;
+	int            *results;
+	int             n;
+	int             next;
+};
+
+static void    *
+probe_worker(void *arg)
+{
+	struct s_ProbeBatch *b = arg;
+	int             i, last;
+
+	for (;;) {
+#ifdef ATOMIC_FETCH_ADD
+		i = ATOMIC_FETCH_ADD(&b->next, kProbeBatch);
+#else
+		i = b->next;
+		b->next += kProbeBatch;
+#endif
+		if (i >= b->n)
+			break;
+		last = MIN(i + kProbeBatch, b->n);
+		for (; i < last; i++)
+			b->results[i] = AIFF_Probe(b->paths[i], &b->infos[i]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Probe 'n' files with 'nThreads' threads (0 for one per
+ * processor), storing the result of each one in 'results'.
+ * Return the number of AIFF files found, or -1 on error.
+ */
+int
+AIFF_ProbeMany(const char **paths, AIFF_Info * infos, int *results,
+    int n, int nThreads)
+{
+	struct s_ProbeBatch b;
+	int             i, found;
+#ifdef AIFF_THREADS
+	pthread_t       threads[kProbeMaxThreads];
+	int             started;
+#endif
+
+	if (!paths || !infos || !results || n < 0)
+		return (-1);
+	b.paths = paths;
+	b.infos = infos;
+	b.results = results;
+	b.n = n;
+	b.next = 0;
+
+	if (nThreads < 1) {
+#ifdef _SC_NPROCESSORS_ONLN
+		nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (nThreads < 1)
+			nThreads = 1;
+	}
+	nThreads = MIN(nThreads, MIN((n + kProbeBatch - 1) / kProbeBatch, kProbeMaxThreads));
+
+#ifdef AIFF_THREADS
+	for (started = 1; started < nThreads; started++) {
+		if (pthread_create(&threads[started], NULL, probe_worker, &b) != 0)
+			break;
+	}
+	probe_worker(&b);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+#else
+	probe_worker(&b);
+#endif
+
+	for (i = 0, found = 0; i < n; i++) {
+		if (results[i] > 0)
+			found++;
+	}
+
+	return (found);
+}
@@ -0,0 +1,306 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Quantization of floating point samples for AIFF_WriteSamplesFloat.
+ *
+ * A sample x (full scale: -1.0 to 1.0) becomes the integer
+ * round(x * 2^(bits-1) + d), clipped, where d is the dither: none,
+ * TPDF (the difference of two uniform values, +/- 1 LSB), or TPDF
+ * with the quantization error fed back through a three-tap filter
+ * that moves the noise to the high frequencies. The integer is then
+ * left-justified in its segment and stored straight in the byte
+ * order of the file, so there is no separate swapping pass.
+ */
+
+#define kQuantBlock	1024	/* samples quantized at a time */
+
+struct s_AIFF_Dither {
+	int             mode;
+	uint32_t        seed;
+	float          *err;	/* three past errors per channel */
+};
+
+/* Error feedback filter (E-weighted, after Wannamaker). */
+static const float shape[3] = {1.623f, -0.982f, 0.109f};
+
+static uint32_t
+xorshift32(uint32_t * s)
+{
+	uint32_t        x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return (*s = x);
+}
+
+/* Uniform in [-0.5, 0.5) LSB. */
+#define UNIFORM(s)	((float) (xorshift32(s) >> 8) * (1.0f / 16777216.0f) - 0.5f)
+
+/*
+ * The noise shaping state is only made once the sound format is
+ * set, while writing samples, since it is kept per channel.
+ */
+static struct s_AIFF_Dither *
+dither_get(AIFF_Ref w)
+{
+	struct s_AIFF_Dither *d = w->dither;
+
+	if (d == NULL) {
+		if ((d = malloc(sizeof(struct s_AIFF_Dither))) == NULL)
+			return (NULL);
+		d->mode = kDitherTPDF;
+		d->seed = 0x9E3779B9;
+		d->err = NULL;
+		w->dither = d;
+	}
+	if (d->mode == kDitherShaped && d->err == NULL && w->stat == 2) {
+		if ((d->err = calloc((size_t) w->nChannels * 3, sizeof(float))) == NULL)
+			return (NULL);
+	}
+	return (d);
+}
+
+void
+dither_destroy(AIFF_Ref w)
+{
+	if (w->dither) {
+		free(w->dither->err);
+		free(w->dither);
+		w->dither = NULL;
+	}
+}
+
+#define CLAMP(q, lo, hi)	((q) > (hi) ? (hi) : ((q) < (lo) ? (lo) : (q)))
+
+/* Scale to LSBs, with NaN and infinities made finite. */
+static double
+to_lsb(float x, double scale)
+{
+	if (!(x > -2.0f && x < 2.0f))
+		x = (x > 0 ? 2.0f : (x < 0 ? -2.0f : 0));
+	return (x * scale);
+}
+
+/*
+ * Quantize 'n' samples (whole frames) to integers of 'bits' bits.
+ */
+static void
+quantize(struct s_AIFF_Dither *d, int nChannels, int bits,
+    const float *in, int32_t * out, int n)
+{
+	double          scale = ldexp(1.0, bits - 1), hi = scale - 1, lo = -scale;
+	double          v, q, t;
+	float          *e;
+	int             i, c;
+
+	switch (d->mode) {
+	case kDitherNone:
+		for (i = 0; i < n; i++) {
+			q = floor(to_lsb(in[i], scale) + 0.5);
+			out[i] = (int32_t) CLAMP(q, lo, hi);
+		}
+		break;
+	case kDitherTPDF:
+		for (i = 0; i < n; i++) {
+			v = to_lsb(in[i], scale) + UNIFORM(&d->seed) + UNIFORM(&d->seed);
+			q = floor(v + 0.5);
+			out[i] = (int32_t) CLAMP(q, lo, hi);
+		}
+		break;
+	case kDitherShaped:
+		for (i = 0; i < n; i += nChannels) {
+			for (c = 0; c < nChannels; c++) {
+				e = d->err + 3 * c;
+				v = to_lsb(in[i + c], scale) -
+				    (shape[0] * e[0] + shape[1] * e[1] + shape[2] * e[2]);
+				q = floor(v + UNIFORM(&d->seed) + UNIFORM(&d->seed) + 0.5);
+				t = q - v;
+				if (q > hi || q < lo) {
+					/* keep the loop stable when clipping */
+					q = CLAMP(q, lo, hi);
+					t = CLAMP(q - v, -1.0, 1.0);
+				}
+				e[2] = e[1];
+				e[1] = e[0];
+				e[0] = (float) t;
+				out[i + c] = (int32_t) q;
+			}
+		}
+		break;
+	}
+}
+
+/*
+ * Store 'n' quantized samples left-justified in segments of
+ * 'seg' bytes, in the byte order of the file.
+ */
+static void
+pack(const int32_t * q, uint8_t * p, int n, int seg, int shift, int little)
+{
+	uint32_t        u;
+	int             i;
+
+	if (little) {
+		for (i = 0; i < n; i++, p += seg) {
+			u = (uint32_t) q[i] << shift;
+			switch (seg) {
+			case 4:
+				p[3] = (uint8_t) (u >> 24);
+				p[2] = (uint8_t) (u >> 16);
+				p[1] = (uint8_t) (u >> 8);
+				p[0] = (uint8_t) u;
+				break;
+			case 3:
+				p[2] = (uint8_t) (u >> 16);
+				p[1] = (uint8_t) (u >> 8);
+				p[0] = (uint8_t) u;
+				break;
+			case 2:
+				p[1] = (uint8_t) (u >> 8);
+				p[0] = (uint8_t) u;
+				break;
+			default:
+				p[0] = (uint8_t) u;
+				break;
+			}
+		}
+	} else {
+		for (i = 0; i < n; i++, p += seg) {
+			u = (uint32_t) q[i] << shift;
+			switch (seg) {
+			case 4:
+				p[0] = (uint8_t) (u >> 24);
+				p[1] = (uint8_t) (u >> 16);
+				p[2] = (uint8_t) (u >> 8);
+				p[3] = (uint8_t) u;
+				break;
+			case 3:
+				p[0] = (uint8_t) (u >> 16);
+				p[1] = (uint8_t) (u >> 8);
+				p[2] = (uint8_t) u;
+				break;
+			case 2:
+				p[0] = (uint8_t) (u >> 8);
+				p[1] = (uint8_t) u;
+				break;
+			default:
+				p[0] = (uint8_t) u;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Choose how AIFF_WriteSamplesFloat quantizes: kDitherNone (round
+ * to the nearest value), kDitherTPDF (the default) or kDitherShaped.
+ */
+int
+AIFF_SetDither(AIFF_Ref w, int mode)
+{
+	struct s_AIFF_Dither *d;
+
+	if (!w || !(w->flags & F_WRONLY) ||
+	    (mode != kDitherNone && mode != kDitherTPDF && mode != kDitherShaped))
+		return (-1);
+	if ((d = dither_get(w)) == NULL)
+		return (-1);
+	d->mode = mode;
+
+	return (1);
+}
+
+/*
+ * Quantize and write 'n' floating point sample points
+ * (whole frames), at the sample size of the file.
+ */
+int
+AIFF_WriteSamplesFloat(AIFF_Ref w, const float *samples, int n)
+{
+	struct s_AIFF_Dither *d;
+	int32_t         q[kQuantBlock];
+	uint8_t        *buf;
+	int             block, m, seg, bits, g711, res = 1;
+	STATS_TIMER(t)
+
+	if (!w || !(w->flags & F_WRONLY) || !samples)
+		return (-1);
+	if (w->stat != 2 || w->nChannels < 1 || n < 1 || n % w->nChannels != 0)
+		return (-1);
+	g711 = (w->audioFormat == AUDIO_FORMAT_ULAW ||
+	    w->audioFormat == AUDIO_FORMAT_ulaw ||
+	    w->audioFormat == AUDIO_FORMAT_ALAW ||
+	    w->audioFormat == AUDIO_FORMAT_alaw);
+	seg = w->segmentSize;
+	bits = (g711 ? 16 : w->bitsPerSample);
+	if (seg < 1 || seg > 4 || bits < 1 || bits > seg * 8 ||
+	    (g711 && seg != 2))
+		return (-1);
+	if ((d = dither_get(w)) == NULL ||
+	    (d->mode == kDitherShaped && d->err == NULL))
+		return (-1);
+
+	block = kQuantBlock - kQuantBlock % w->nChannels;
+	if (block < w->nChannels)
+		return (-1);
+	if ((buf = AIFFBufAllocate(w, kAIFFBufExt, (unsigned int) block * seg)) == NULL)
+		return (-1);
+
+	for (; n > 0 && res > 0; n -= m, samples += m) {
+		m = MIN(n, block);
+		STATS_START(t);
+		quantize(d, w->nChannels, bits, samples, q, m);
+		if (g711) {
+			/* the encoder takes 16-bit samples in host order */
+			int16_t        *s16 = (int16_t *) (void *) buf;
+			int             i;
+
+			for (i = 0; i < m; i++)
+				s16[i] = (int16_t) q[i];
+			STATS_STOP(w, convertNanos, t);
+			res = AIFFWriteSamples(w, buf, (size_t) m * 2, 0);
+		} else {
+			pack(q, buf, m, seg, seg * 8 - bits,
+			    (w->flags & LPCM_LTE_ENDIAN) != 0);
+			STATS_STOP(w, convertNanos, t);
+			res = AIFF_WriteSamplesRaw(w, buf, (size_t) m * seg);
+		}
+	}
+
+	return (res < 0 ? -1 : res);
+}
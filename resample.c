@@ -0,0 +1,376 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Sample rate conversion on the read path.
+ *
+ * Output frame k lies at input time k * in / out, kept as an input
+ * frame 'pos' plus a remainder 'rem' / out, so the timing is exact
+ * and a seek lands on the very same instants as reading through.
+ * Each output sample is the dot product of the 2 * half input
+ * samples around that time with a row of the polyphase kernel table;
+ * the two rows around the remainder are interpolated.
+ *
+ * The input is kept one contiguous array per channel ('x', 'cap'
+ * frames each), holding input frames 'base' to 'base' + 'len' - 1.
+ * Frames before the start and past the end of the sound are zeros.
+ */
+
+#define kResampleBlock	1024	/* input frames read at a time */
+#define kSincPhases	256
+#define kSincHalf	16	/* taps on each side, when not downsampling */
+#define kSincMaxHalf	256
+#define kKaiserBeta	8.0
+
+struct s_AIFF_Resampler {
+	int             nChannels;
+	uint64_t        in, out;	/* rates, over their gcd */
+	uint64_t        stepInt, stepRem;	/* in / out */
+	int             half;
+	int             nPhases;
+	float          *coefs;	/* nPhases + 1 rows of 2 * half */
+	float          *x;
+	float          *block;	/* interleaved block from the decoder */
+	unsigned int    cap;
+	unsigned int    len;
+	int64_t         base;
+	uint64_t        pos;
+	uint64_t        rem;
+	int             eof;
+	int64_t         end;	/* input frames in the sound, once at the end */
+};
+
+static uint64_t
+gcd64(uint64_t a, uint64_t b)
+{
+	uint64_t        t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return (a);
+}
+
+/* Zeroth order modified Bessel function of the first kind. */
+static double
+bessel_i0(double x)
+{
+	double          sum = 1, term = 1, y = x * x / 4;
+	int             k;
+
+	for (k = 1; k < 64 && term > sum * 1e-12; k++) {
+		term *= y / ((double) k * k);
+		sum += term;
+	}
+	return (sum);
+}
+
+/*
+ * Fill the kernel table. Row p holds the taps for an output time
+ * p / nPhases of the way between two input frames.
+ */
+static void
+resample_make_kernel(struct s_AIFF_Resampler *s, int quality, double cutoff)
+{
+	double          d, v, sum, arg;
+	int             p, j, n = 2 * s->half;
+	float          *row;
+
+	for (p = 0; p <= s->nPhases; p++) {
+		row = s->coefs + (size_t) p * n;
+		sum = 0;
+		for (j = 0; j < n; j++) {
+			d = (j - s->half + 1) - (double) p / s->nPhases;
+			if (quality == kResampleLinear) {
+				v = 1.0 - fabs(d);
+				v = (v > 0 ? v : 0);
+			} else {
+				v = cutoff * d;
+				v = (fabs(v) < 1e-9 ? 1.0 : sin(M_PI * v) / (M_PI * v));
+				arg = d / s->half;
+				arg = 1.0 - arg * arg;
+				v *= (arg > 0 ? bessel_i0(kKaiserBeta * sqrt(arg)) /
+				    bessel_i0(kKaiserBeta) : 0);
+			}
+			row[j] = (float) v;
+			sum += v;
+		}
+		for (j = 0; j < n; j++)
+			row[j] = (float) (row[j] / sum);
+	}
+}
+
+/*
+ * Start over at input time 'pos' + 'rem' / out. The first input frame
+ * needed, pos - half + 1, may be before the start of the sound.
+ */
+static int
+resample_restart(AIFF_Ref r, uint64_t pos, uint64_t rem, int seek)
+{
+	struct s_AIFF_Resampler *s = r->resampler;
+	int64_t         base = (int64_t) pos - s->half + 1;
+	unsigned int    zeros = 0;
+	int             c;
+
+	if (base < 0) {
+		zeros = (unsigned int) -base;
+		for (c = 0; c < s->nChannels; c++)
+			memset(s->x + (size_t) c * s->cap, 0, zeros * sizeof(float));
+	}
+	if (seek && AIFFSeek(r, (uint64_t) (base < 0 ? 0 : base)) < 1)
+		return (-1);
+	s->base = base;
+	s->len = zeros;
+	s->pos = pos;
+	s->rem = rem;
+	s->eof = 0;
+
+	return (1);
+}
+
+/*
+ * Make sure the input frames up to 'pos' + half are in.
+ */
+static int
+resample_fill(AIFF_Ref r)
+{
+	struct s_AIFF_Resampler *s = r->resampler;
+	int64_t         need = (int64_t) s->pos + s->half, drop;
+	unsigned int    room, n, i;
+	int             c, got, nc = s->nChannels;
+	float          *plane;
+
+	while (s->base + (int64_t) s->len <= need) {
+		/* drop the frames no longer needed */
+		drop = (int64_t) s->pos - s->half + 1 - s->base;
+		if (drop > (int64_t) s->len)
+			drop = s->len;	/* a long step: these are skipped */
+		if (drop > 0 && s->len + kResampleBlock > s->cap) {
+			for (c = 0; c < nc; c++) {
+				plane = s->x + (size_t) c * s->cap;
+				memmove(plane, plane + drop,
+				    (s->len - (size_t) drop) * sizeof(float));
+			}
+			s->base += drop;
+			s->len -= (unsigned int) drop;
+		}
+		room = MIN((unsigned int) kResampleBlock, s->cap - s->len);
+
+		if (s->eof) {
+			/* past the end: zeros */
+			n = room;
+			for (c = 0; c < nc; c++)
+				memset(s->x + (size_t) c * s->cap + s->len, 0,
+				    n * sizeof(float));
+		} else {
+			if ((got = AIFFReadFloat(r, s->block, (int) room * nc)) < 0)
+				return (-1);
+			if (got == 0) {
+				s->eof = 1;
+				s->end = s->base + s->len;
+				continue;
+			}
+			n = (unsigned int) got / nc;
+			for (c = 0; c < nc; c++) {
+				plane = s->x + (size_t) c * s->cap + s->len;
+				for (i = 0; i < n; i++)
+					plane[i] = s->block[(size_t) i * nc + c];
+			}
+		}
+		s->len += n;
+	}
+
+	return (1);
+}
+
+static float
+dot(const float *x, const float *h, int n)
+{
+	float           a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+	int             i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a0 += x[i] * h[i];
+		a1 += x[i + 1] * h[i + 1];
+		a2 += x[i + 2] * h[i + 2];
+		a3 += x[i + 3] * h[i + 3];
+	}
+	for (; i < n; i++)
+		a0 += x[i] * h[i];
+	return ((a0 + a1) + (a2 + a3));
+}
+
+/*
+ * Reader side of AIFF_ReadSamplesFloat.
+ */
+int
+resample_read(AIFF_Ref r, float *buffer, int nSamplePoints)
+{
+	struct s_AIFF_Resampler *s = r->resampler;
+	int             nc = s->nChannels, n = 2 * s->half, c, k, want;
+	uint64_t        ph;
+	const float    *row, *plane;
+	float           f, y0, y1;
+	size_t          off;
+
+	want = nSamplePoints / nc;
+	for (k = 0; k < want; k++) {
+		if (resample_fill(r) < 0)
+			return (k > 0 ? k * nc : -1);
+		if (s->eof && (int64_t) s->pos >= s->end)
+			break;
+
+		ph = s->rem * s->nPhases;
+		row = s->coefs + (size_t) (ph / s->out) * n;
+		f = (float) (ph % s->out) / (float) s->out;
+		off = (size_t) ((int64_t) s->pos - s->half + 1 - s->base);
+		for (c = 0; c < nc; c++) {
+			plane = s->x + (size_t) c * s->cap + off;
+			y0 = dot(plane, row, n);
+			y1 = (f > 0 ? dot(plane, row + n, n) : y0);
+			buffer[(size_t) k * nc + c] = y0 + f * (y1 - y0);
+		}
+
+		s->pos += s->stepInt;
+		s->rem += s->stepRem;
+		if (s->rem >= s->out) {
+			s->rem -= s->out;
+			s->pos++;
+		}
+	}
+
+	return (k * nc);
+}
+
+/*
+ * Seek to output frame 'framePos'.
+ */
+int
+resample_seek(AIFF_Ref r, uint64_t framePos)
+{
+	struct s_AIFF_Resampler *s = r->resampler;
+	uint64_t        pos, rem;
+
+	pos = framePos / s->out * s->in + framePos % s->out * s->in / s->out;
+	rem = framePos % s->out * s->in % s->out;
+	if (pos >= r->nSamples)
+		return (0);
+
+	return (resample_restart(r, pos, rem, 1));
+}
+
+void
+resample_destroy(AIFF_Ref r)
+{
+	struct s_AIFF_Resampler *s = r->resampler;
+
+	if (s == NULL)
+		return;
+	free(s->coefs);
+	free(s->x);
+	free(s->block);
+	free(s);
+	r->resampler = NULL;
+}
+
+/*
+ * Make AIFF_ReadSamplesFloat return the sound of 'r' at 'rate'
+ * samples per second, and AIFF_Seek take sample frames at that rate.
+ * A rate of 0, or the rate of the file, removes the resampler.
+ * Reading (re)starts at the start of the sound, or where the file
+ * is if it is not seekable.
+ */
+int
+AIFF_SetOutputRate(AIFF_Ref r, double rate, int quality)
+{
+	struct s_AIFF_Resampler *s;
+	uint64_t        in, out, g;
+	double          cutoff;
+	int             nc;
+
+	if (!r || !(r->flags & F_RDONLY) || r->nChannels < 1 || rate < 0 ||
+	    (quality != kResampleLinear && quality != kResampleSinc))
+		return (-1);
+	in = (uint64_t) (r->samplingRate + 0.5);
+	out = (uint64_t) (rate + 0.5);
+	if (out > 0 && (in < 1 || in > 0xFFFFFFFF || out > 0xFFFFFFFF))
+		return (-1);
+
+	resample_destroy(r);
+	if (out == 0 || out == in)
+		return (1);
+	g = gcd64(in, out);
+	in /= g;
+	out /= g;
+
+	nc = r->nChannels;
+	if ((s = malloc(sizeof(struct s_AIFF_Resampler))) == NULL)
+		return (-1);
+	memset(s, 0, sizeof(struct s_AIFF_Resampler));
+	s->nChannels = nc;
+	s->in = in;
+	s->out = out;
+	s->stepInt = in / out;
+	s->stepRem = in % out;
+	cutoff = (out < in ? (double) out / in : 1.0);
+	if (quality == kResampleLinear) {
+		s->half = 1;
+		s->nPhases = 1;
+	} else {
+		s->half = (int) MIN(ceil(kSincHalf / cutoff), (double) kSincMaxHalf);
+		s->nPhases = kSincPhases;
+	}
+	s->cap = 2 * s->half + kResampleBlock;
+	s->coefs = malloc((size_t) (s->nPhases + 1) * 2 * s->half * sizeof(float));
+	s->x = malloc((size_t) nc * s->cap * sizeof(float));
+	s->block = malloc((size_t) kResampleBlock * nc * sizeof(float));
+	r->resampler = s;
+	if (s->coefs == NULL || s->x == NULL || s->block == NULL) {
+		resample_destroy(r);
+		return (-1);
+	}
+	resample_make_kernel(s, quality, cutoff);
+
+	if (resample_restart(r, 0, 0, !(r->flags & F_NOTSEEKABLE)) < 1) {
+		resample_destroy(r);
+		return (-1);
+	}
+
+	return (1);
+}
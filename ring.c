@@ -0,0 +1,232 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Single-producer / single-consumer ring of sample frames.
+ *
+ * The producer (AIFF_RingFill) makes the codec decode straight
+ * into the ring memory; the consumer (AIFF_RingRead) only copies
+ * frames out, never waits and never allocates.
+ *
+ * 'head' is written by the producer only and 'tail' by the consumer
+ * only. Both are free-running frame counters; the ring size is a power
+ * of two so (head - tail) is the number of frames in the ring.
+ */
+
+#define kRingPad	64	/* keep 'head' and 'tail' in different cache lines */
+
+struct s_AIFF_Ring {
+	uint8_t        *data;
+	unsigned int    size;	/* in sample frames */
+	unsigned int    mask;
+	unsigned int    frameSize;	/* in bytes */
+	int             format;
+	int             nChannels;
+	int             segmentSize;
+	char            pad0[kRingPad];
+	unsigned int    head;
+	int             state;	/* 0: running, 1: end of sound, -1: error */
+	char            pad1[kRingPad];
+	unsigned int    tail;
+	char            pad2[kRingPad];
+};
+
+AIFF_RingRef
+AIFF_RingCreate(AIFF_Ref r, unsigned int nFrames, int format)
+{
+	AIFF_RingRef    q;
+	unsigned int    size;
+
+	if (!r || !(r->flags & F_RDONLY) || r->nChannels < 1 || nFrames < 1)
+		return (NULL);
+	if (format != kRingLPCM && format != kRingFloat)
+		return (NULL);
+	for (size = 1; size < nFrames; size <<= 1) {
+		if (size > 0x7FFFFFFF)
+			return (NULL);
+	}
+
+	if ((q = malloc(sizeof(struct s_AIFF_Ring))) == NULL)
+		return (NULL);
+	q->format = format;
+	q->nChannels = r->nChannels;
+	q->segmentSize = r->segmentSize;
+	if (format == kRingFloat)
+		q->frameSize = r->nChannels * sizeof(float);
+	else
+		q->frameSize = r->nChannels * r->segmentSize;
+	q->size = size;
+	q->mask = size - 1;
+	if ((q->data = malloc((size_t) size * q->frameSize)) == NULL) {
+		free(q);
+		return (NULL);
+	}
+	AIFF_RingReset(q);
+
+	return (q);
+}
+
+void
+AIFF_RingDelete(AIFF_RingRef q)
+{
+	if (q) {
+		free(q->data);
+		free(q);
+	}
+}
+
+/*
+ * Empty the ring. Neither side may be using it.
+ */
+void
+AIFF_RingReset(AIFF_RingRef q)
+{
+	q->head = q->tail = 0;
+	q->state = 0;
+	ATOMIC_FENCE();
+}
+
+unsigned int
+AIFF_RingReadable(AIFF_RingRef q)
+{
+	return (ATOMIC_LOAD(&q->head) - q->tail);
+}
+
+unsigned int
+AIFF_RingWritable(AIFF_RingRef q)
+{
+	return (q->size - (q->head - ATOMIC_LOAD(&q->tail)));
+}
+
+/*
+ * Return 0 if more frames may come, 1 if the producer reached
+ * the end of the sound and the ring has been drained, -1 if the
+ * producer failed and the ring has been drained.
+ */
+int
+AIFF_RingEnded(AIFF_RingRef q)
+{
+	int             st = ATOMIC_LOAD(&q->state);
+
+	if (st == 0 || ATOMIC_LOAD(&q->head) != q->tail)
+		return (0);
+	return (st);
+}
+
+/*
+ * Consumer side: copy out up to 'nFrames' frames and
+ * return the number of frames copied.
+ */
+unsigned int
+AIFF_RingRead(AIFF_RingRef q, void *frames, unsigned int nFrames)
+{
+	unsigned int    tail, n, first;
+	uint8_t        *out = frames;
+
+	/* load 'head' once: MIN() evaluates its arguments twice */
+	tail = q->tail;
+	n = ATOMIC_LOAD(&q->head) - tail;
+	n = MIN(nFrames, n);
+	if (n == 0)
+		return (0);
+	first = MIN(n, q->size - (tail & q->mask));
+
+	memcpy(out, q->data + (size_t) (tail & q->mask) * q->frameSize,
+	    (size_t) first * q->frameSize);
+	if (n > first)
+		memcpy(out + (size_t) first * q->frameSize, q->data,
+		    (size_t) (n - first) * q->frameSize);
+	ATOMIC_STORE(&q->tail, tail + n);
+
+	return (n);
+}
+
+/*
+ * Producer side: decode up to 'nFrames' frames from the (prepared)
+ * file straight into the free space of the ring. Return the number
+ * of frames decoded, or -1 on error.
+ */
+int
+ring_fill(AIFF_Ref r, AIFF_RingRef q, unsigned int nFrames)
+{
+	struct codec   *dec = r->codec;
+	unsigned int    head, room, span, got, done = 0;
+	uint64_t        pos;
+	uint8_t        *dst;
+
+	if (q->nChannels != r->nChannels || q->segmentSize != r->segmentSize)
+		return (-1);
+
+	head = q->head;
+	room = q->size - (head - ATOMIC_LOAD(&q->tail));
+	nFrames = MIN(nFrames, room);
+
+	while (done < nFrames) {
+		span = MIN(nFrames - done, q->size - (head & q->mask));
+		dst = q->data + (size_t) (head & q->mask) * q->frameSize;
+
+		pos = r->pos;
+		if (q->format == kRingFloat) {
+			int             n;
+
+			TRACE_BEGIN(r, kTraceReadFloat);
+			n = dec->read_float32(r, (float *) dst,
+			    (int) span * q->nChannels);
+			TRACE_END(r, kTraceReadFloat, r->pos - pos);
+			got = (n > 0 ? n / q->nChannels : 0);
+			if (n < 0) {
+				ATOMIC_STORE(&q->state, -1);
+				return (-1);
+			}
+		} else {
+			size_t          n;
+
+			TRACE_BEGIN(r, kTraceReadLPCM);
+			n = dec->read_lpcm(r, dst, (size_t) span * q->frameSize);
+			TRACE_END(r, kTraceReadLPCM, r->pos - pos);
+			got = n / q->frameSize;
+		}
+
+		if (got == 0) {
+			ATOMIC_STORE(&q->state, 1);
+			break;
+		}
+		head += got;
+		done += got;
+		ATOMIC_STORE(&q->head, head);
+	}
+
+	return ((int) done);
+}
@@ -0,0 +1,325 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Leading and trailing silence.
+ *
+ * A sample frame is sound when the absolute value of the sample of
+ * any channel is above the threshold of that channel, and the sound
+ * starts (or ends) with the first (or last) run of at least the hold
+ * length of such frames; shorter runs, such as clicks, are silence.
+ * The sound is searched from the start forwards and from the end
+ * backwards, block by block, so only the silent ends of the file (and
+ * one block on each side) are decoded. Each block is first reduced to
+ * its loudest sample, which the compiler can vectorize, and skipped if
+ * that is within the lowest threshold; only the blocks which are not
+ * are searched frame by frame.
+ */
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef AIFF_THREADS
+#include <pthread.h>
+#endif
+
+#define kSilenceBlock		4096	/* sample frames read at a time */
+#define kSilenceMaxThreads	64
+
+static float
+block_peak(const float *x, size_t n)
+{
+	float           m0 = 0, m1 = 0, v0, v1;
+	size_t          i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		v0 = (x[i] < 0 ? -x[i] : x[i]);
+		v1 = (x[i + 1] < 0 ? -x[i + 1] : x[i + 1]);
+		m0 = (v0 > m0 ? v0 : m0);
+		m1 = (v1 > m1 ? v1 : m1);
+	}
+	if (i < n) {
+		v0 = (x[i] < 0 ? -x[i] : x[i]);
+		m0 = (v0 > m0 ? v0 : m0);
+	}
+	return (MAX(m0, m1));
+}
+
+static int
+is_sound(const float *frame, int nChannels, const float *thresholds)
+{
+	int             c;
+
+	for (c = 0; c < nChannels; c++) {
+		if (frame[c] > thresholds[c] || frame[c] < -thresholds[c])
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Read the 'n' frames from 'frame' on into 'buf'.
+ */
+static int
+read_block(AIFF_Ref r, uint64_t frame, float *buf, unsigned int n)
+{
+	int             got, want, done = 0;
+
+	if (AIFF_Seek(r, frame) < 1)
+		return (-1);
+	want = (int) n * r->nChannels;
+	while (done < want) {
+		if ((got = AIFF_ReadSamplesFloat(r, buf + done, want - done)) < 1)
+			return (-1);
+		done += got;
+	}
+	return (1);
+}
+
+/*
+ * AIFF_FindSilence with 'nThresholds' entries in 'thresholds'; the
+ * other channels take 'threshold'.
+ */
+static int
+find_silence(AIFF_Ref r, float threshold, const float *thresholds,
+    int nThresholds, uint64_t holdFrames, AIFF_Trim * trim)
+{
+	float          *buf, *thr, lowest = 0;
+	uint64_t        frame, first = 0, last = 0, edge = 0, run = 0;
+	unsigned int    n, i;
+	int             c, nc, res = 0;
+
+	if (!r || !trim || !(r->flags & F_RDONLY) || (r->flags & F_NOTSEEKABLE) ||
+	    r->prefetch || r->resampler || r->nChannels < 1)
+		return (-1);
+	trim->start = trim->end = 0;
+	nc = r->nChannels;
+	if ((buf = malloc(((size_t) kSilenceBlock + 1) * nc * sizeof(float))) == NULL)
+		return (-1);
+	thr = buf + (size_t) kSilenceBlock * nc;
+	for (c = 0; c < nc; c++) {
+		thr[c] = (thresholds && c < nThresholds ? thresholds[c] : threshold);
+		if (!(thr[c] >= 0)) {
+			free(buf);
+			return (-1);
+		}
+		if (c == 0 || thr[c] < lowest)
+			lowest = thr[c];
+	}
+	if (holdFrames < 1)
+		holdFrames = 1;
+
+	/* forwards, to the start of the first run of sound */
+	for (frame = 0; frame < r->nSamples && res == 0; frame += n) {
+		n = (unsigned int) MIN(r->nSamples - frame, (uint64_t) kSilenceBlock);
+		if (read_block(r, frame, buf, n) < 0) {
+			res = -1;
+			break;
+		}
+		if (!(block_peak(buf, (size_t) n * nc) > lowest)) {
+			run = 0;
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			if (!is_sound(buf + (size_t) i * nc, nc, thr)) {
+				run = 0;
+				continue;
+			}
+			if (run++ == 0)
+				edge = frame + i;
+			if (run >= holdFrames) {
+				first = edge;
+				res = 1;
+				break;
+			}
+		}
+	}
+
+	/* backwards, to the end of the last one (at or after the first) */
+	run = 0;
+	for (frame = r->nSamples; res == 1 && frame > first; frame -= n) {
+		n = (unsigned int) MIN(frame - first, (uint64_t) kSilenceBlock);
+		if (read_block(r, frame - n, buf, n) < 0) {
+			res = -1;
+			break;
+		}
+		if (!(block_peak(buf, (size_t) n * nc) > lowest)) {
+			run = 0;
+			continue;
+		}
+		for (i = n; i > 0; i--) {
+			if (!is_sound(buf + (size_t) (i - 1) * nc, nc, thr)) {
+				run = 0;
+				continue;
+			}
+			if (run++ == 0)
+				edge = frame - n + i - 1;
+			if (run >= holdFrames) {
+				last = edge;
+				res = 2;
+				break;
+			}
+		}
+	}
+	free(buf);
+
+	if (res < 0)
+		return (-1);
+	if (res == 0)
+		return (AIFF_Seek(r, 0) < 0 ? -1 : 0);
+	trim->start = first;
+	trim->end = last + 1;
+	if (AIFF_Seek(r, trim->start) < 0)
+		return (-1);
+
+	return (1);
+}
+
+/*
+ * Find where the sound of 'r' starts and ends. 'thresholds', if not
+ * NULL, holds the largest absolute sample value taken as silence for
+ * each channel; otherwise 'threshold' is used for all of them. Runs of
+ * sound shorter than 'holdFrames' frames are taken as silence. On
+ * return 'r' is at 'trim->start'. Return 1, 0 if the whole file is
+ * silent (and 'trim' is empty), or -1 on error.
+ */
+int
+AIFF_FindSilence(AIFF_Ref r, float threshold, const float *thresholds,
+    uint64_t holdFrames, AIFF_Trim * trim)
+{
+	return (find_silence(r, threshold, thresholds, r ? r->nChannels : 0,
+	    holdFrames, trim));
+}
+
+struct s_SilenceBatch {
+	const char    **paths;
+	AIFF_Trim      *trims;
+	int            *results;
+	int             n;
+	int             next;
+	float           threshold;
+	const float    *thresholds;
+	int             nThresholds;
+	uint64_t        holdFrames;
+};
+
+static void    *
+silence_worker(void *arg)
+{
+	struct s_SilenceBatch *b = arg;
+	AIFF_Ref        r;
+	int             i;
+
+	for (;;) {
+#ifdef ATOMIC_FETCH_ADD
+		i = ATOMIC_FETCH_ADD(&b->next, 1);
+#else
+		i = b->next++;
+#endif
+		if (i >= b->n)
+			break;
+		b->results[i] = -1;
+		b->trims[i].start = b->trims[i].end = 0;
+		if ((r = AIFF_OpenFile(b->paths[i], F_RDONLY)) == NULL)
+			continue;
+		b->results[i] = find_silence(r, b->threshold, b->thresholds,
+		    b->nThresholds, b->holdFrames, &b->trims[i]);
+		AIFF_CloseFile(r);
+	}
+
+	return (NULL);
+}
+
+/*
+ * AIFF_FindSilence on 'n' files, with 'nThreads' threads (0 for one
+ * per processor), storing the result of each one in 'results'.
+ * 'thresholds' holds 'nThresholds' per channel values; the other
+ * channels take 'threshold'. Return the number of files with sound,
+ * or -1 on error.
+ */
+int
+AIFF_FindSilenceMany(const char **paths, AIFF_Trim * trims, int *results,
+    int n, float threshold, const float *thresholds, int nThresholds,
+    uint64_t holdFrames, int nThreads)
+{
+	struct s_SilenceBatch b;
+	int             i, found;
+#ifdef AIFF_THREADS
+	pthread_t       threads[kSilenceMaxThreads];
+	int             started;
+#endif
+
+	if (!paths || !trims || !results || n < 0 || nThresholds < 0 ||
+	    (thresholds == NULL && nThresholds > 0))
+		return (-1);
+	b.paths = paths;
+	b.trims = trims;
+	b.results = results;
+	b.n = n;
+	b.next = 0;
+	b.threshold = threshold;
+	b.thresholds = thresholds;
+	b.nThresholds = nThresholds;
+	b.holdFrames = holdFrames;
+
+	if (nThreads < 1) {
+#ifdef _SC_NPROCESSORS_ONLN
+		nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (nThreads < 1)
+			nThreads = 1;
+	}
+	nThreads = MIN(nThreads, MIN(n, kSilenceMaxThreads));
+
+#ifdef AIFF_THREADS
+	for (started = 1; started < nThreads; started++) {
+		if (pthread_create(&threads[started], NULL, silence_worker, &b) != 0)
+			break;
+	}
+	silence_worker(&b);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+#else
+	silence_worker(&b);
+#endif
+
+	for (i = 0, found = 0; i < n; i++) {
+		if (results[i] > 0)
+			found++;
+	}
+
+	return (found);
+}
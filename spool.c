@@ -0,0 +1,316 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+
+/*
+ * Asynchronous writing.
+ *
+ * The writer copies the samples into a queue of preallocated
+ * blocks and a worker thread encodes them and writes them out,
+ * so the writer never waits for the disk nor allocates. If the
+ * queue is full the samples are dropped (and counted).
+ *
+ * The writer fills the block at 'head' and publishes it when it
+ * is full (or when the sound ends); the worker consumes the block
+ * at 'tail'. Both are free-running block counters. The worker
+ * sleeps on 'wake' when the queue is empty, see prefetch.c.
+ */
+
+#ifdef AIFF_THREADS
+
+#include <pthread.h>
+#include <semaphore.h>
+
+struct s_AIFF_Spool {
+	pthread_t       thread;
+	sem_t           wake;
+	int             quit;
+	int             waiting;
+	int             failed;
+	uint8_t        *data;
+	unsigned int   *len;
+	uint8_t        *raw;	/* block holds raw (not encoded) data */
+	unsigned int    nBlocks;
+	unsigned int    blockSize;	/* in bytes */
+	unsigned int    fill;	/* bytes in the block being filled */
+	unsigned int    head;
+	unsigned int    tail;
+	unsigned int    highWater;
+	uint64_t        dropped;
+};
+
+/*
+ * Worker side.
+ */
+static int
+spool_output(AIFF_Ref w, uint8_t *block, unsigned int len, int raw)
+{
+	STATS_TIMER(t)
+
+	if (!raw) {
+		uint64_t        bytes = w->sampleBytes;
+		int             res;
+
+		TRACE_BEGIN(w, kTraceWriteLPCM);
+		res = w->codec->write_lpcm(w, block, len, 0);
+		TRACE_END(w, kTraceWriteLPCM, w->sampleBytes - bytes);
+		if (res < 1)
+			return (-1);
+		return (checkpoint_update(w));
+	}
+
+	checksum_update(w, block, len);
+	STATS_START(t);
+	if (fwrite(block, 1, len, w->fd) != len)
+		return (-1);
+	STATS_WRITE(w, len, t);
+	w->nSamples += len / (AIFFFrameSize(w) / w->nChannels);
+	w->sampleBytes += len;
+	w->len += len;
+
+	return (checkpoint_update(w));
+}
+
+static void    *
+spool_worker(void *arg)
+{
+	AIFF_Ref        w = arg;
+	struct s_AIFF_Spool *s = w->spool;
+	unsigned int    tail, i;
+
+	for (;;) {
+		tail = s->tail;
+		if (ATOMIC_LOAD(&s->head) == tail) {
+			if (ATOMIC_LOAD(&s->quit))
+				break;
+			ATOMIC_EXCHANGE(&s->waiting, 1);
+			if ((ATOMIC_LOAD(&s->head) == tail && !ATOMIC_LOAD(&s->quit)) ||
+			    ATOMIC_EXCHANGE(&s->waiting, 0) == 0) {
+				while (sem_wait(&s->wake) != 0)
+					continue;
+			}
+			continue;
+		}
+
+		i = tail % s->nBlocks;
+		if (!s->failed && spool_output(w, s->data + (size_t) i * s->blockSize,
+		    s->len[i], s->raw[i]) < 1)
+			ATOMIC_STORE(&s->failed, 1);
+		ATOMIC_STORE(&s->tail, tail + 1);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Writer side.
+ */
+static void
+spool_publish(struct s_AIFF_Spool *s)
+{
+	unsigned int    used;
+
+	s->len[s->head % s->nBlocks] = s->fill;
+	s->fill = 0;
+	ATOMIC_STORE(&s->head, s->head + 1);
+
+	used = s->head - ATOMIC_LOAD(&s->tail);
+	if (used > s->highWater)
+		s->highWater = used;
+
+	ATOMIC_FENCE();
+	if (ATOMIC_LOAD(&s->waiting) && ATOMIC_EXCHANGE(&s->waiting, 0))
+		sem_post(&s->wake);
+}
+
+int
+spool_start(AIFF_Ref w, int nBlocks, int blockFrames)
+{
+	struct s_AIFF_Spool *s;
+
+	if (nBlocks < 2 || blockFrames < 1)
+		return (0);
+	if ((s = malloc(sizeof(struct s_AIFF_Spool))) == NULL)
+		return (-1);
+	s->nBlocks = nBlocks;
+	s->blockSize = (unsigned int) blockFrames * w->nChannels * w->segmentSize;
+	s->data = malloc((size_t) nBlocks * s->blockSize);
+	s->len = malloc(nBlocks * sizeof(unsigned int));
+	s->raw = malloc(nBlocks);
+	if (s->data == NULL || s->len == NULL || s->raw == NULL)
+		goto fail;
+
+	s->quit = s->waiting = s->failed = 0;
+	s->fill = s->head = s->tail = 0;
+	s->highWater = 0;
+	s->dropped = 0;
+	if (sem_init(&s->wake, 0, 0) != 0)
+		goto fail;
+	w->spool = s;
+	if (pthread_create(&s->thread, NULL, spool_worker, w) != 0) {
+		sem_destroy(&s->wake);
+		w->spool = NULL;
+		goto fail;
+	}
+
+	return (1);
+
+fail:
+	free(s->raw);
+	free(s->len);
+	free(s->data);
+	free(s);
+	return (-1);
+}
+
+/*
+ * Queue 'len' bytes of samples ('raw' if they need no encoding).
+ * Return 1, or -1 if the worker failed to write.
+ */
+int
+spool_write(AIFF_Ref w, void *samples, size_t len, int raw)
+{
+	struct s_AIFF_Spool *s = w->spool;
+	uint8_t        *p = samples;
+	unsigned int    n, i;
+
+	if (ATOMIC_LOAD(&s->failed))
+		return (-1);
+
+	while (len > 0) {
+		i = s->head % s->nBlocks;
+		if (s->fill > 0 && s->raw[i] != raw)
+			spool_publish(s);
+		if (s->fill == 0) {
+			if (s->head - ATOMIC_LOAD(&s->tail) >= s->nBlocks) {
+				/* Queue full: drop the rest */
+				s->dropped += (len + s->blockSize - 1) / s->blockSize;
+				break;
+			}
+			i = s->head % s->nBlocks;
+			s->raw[i] = (uint8_t) raw;
+		}
+		n = (unsigned int) MIN(len, (size_t) (s->blockSize - s->fill));
+		memcpy(s->data + (size_t) i * s->blockSize + s->fill, p, n);
+		s->fill += n;
+		p += n;
+		len -= n;
+		if (s->fill == s->blockSize)
+			spool_publish(s);
+	}
+
+	return (1);
+}
+
+/*
+ * Write out everything queued and stop the worker. Return 1,
+ * or -1 if the worker failed to write.
+ */
+int
+spool_finish(AIFF_Ref w)
+{
+	struct s_AIFF_Spool *s = w->spool;
+	int             res;
+
+	if (s == NULL)
+		return (1);
+	if (s->fill > 0)
+		spool_publish(s);
+	ATOMIC_STORE(&s->quit, 1);
+	sem_post(&s->wake);
+	pthread_join(s->thread, NULL);
+	sem_destroy(&s->wake);
+
+	res = (s->failed ? -1 : 1);
+	free(s->raw);
+	free(s->len);
+	free(s->data);
+	free(s);
+	w->spool = NULL;
+
+	return (res);
+}
+
+void
+spool_stats(AIFF_Ref w, unsigned int *highWater, uint64_t *dropped)
+{
+	struct s_AIFF_Spool *s = w->spool;
+
+	if (highWater)
+		*highWater = s->highWater;
+	if (dropped)
+		*dropped = s->dropped;
+}
+
+#else /* !AIFF_THREADS */
+
+int
+spool_start(AIFF_Ref w, int nBlocks, int blockFrames)
+{
+	(void) w;
+	(void) nBlocks;
+	(void) blockFrames;
+	return (-1);
+}
+
+int
+spool_write(AIFF_Ref w, void *samples, size_t len, int raw)
+{
+	(void) w;
+	(void) samples;
+	(void) len;
+	(void) raw;
+	return (-1);
+}
+
+int
+spool_finish(AIFF_Ref w)
+{
+	(void) w;
+	return (1);
+}
+
+void
+spool_stats(AIFF_Ref w, unsigned int *highWater, uint64_t *dropped)
+{
+	(void) w;
+	if (highWater)
+		*highWater = 0;
+	if (dropped)
+		*dropped = 0;
+}
+
+#endif /* AIFF_THREADS */
@@ -0,0 +1,134 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * I/O instrumentation.
+ *
+ * With --enable-stats every reference counts the bytes and calls
+ * of its sample reads and writes, its seeks, the chunk headers it
+ * reads and the reallocations of its work buffers, and times three
+ * stages with a monotonic clock: the I/O calls, the byte swapping
+ * and the conversion between the file and the caller formats.
+ * The counters of a reference are added to the global ones when
+ * it is closed.
+ *
+ * A reference is counted by the thread that uses it (or by its
+ * read-ahead or spool worker, which touch other counters), so
+ * only the global counters need atomic updates.
+ */
+
+#include <time.h>
+
+/*
+ * Nanoseconds from an arbitrary origin, or 0 if there is no
+ * monotonic clock. Also used by the tracing hooks.
+ */
+uint64_t
+stats_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec);
+#endif
+	return (0);
+}
+
+#ifdef AIFF_STATS
+
+static AIFF_IOStats global;
+
+static void
+stats_add(uint64_t * to, uint64_t v)
+{
+#ifdef ATOMIC_FETCH_ADD
+	ATOMIC_FETCH_ADD(to, v);
+#else
+	*to += v;
+#endif
+}
+
+void
+stats_merge(AIFF_Ref r)
+{
+	stats_add(&global.bytesRead, r->stats.bytesRead);
+	stats_add(&global.bytesWritten, r->stats.bytesWritten);
+	stats_add(&global.readCalls, r->stats.readCalls);
+	stats_add(&global.writeCalls, r->stats.writeCalls);
+	stats_add(&global.seeks, r->stats.seeks);
+	stats_add(&global.chunkScans, r->stats.chunkScans);
+	stats_add(&global.bufAllocs, r->stats.bufAllocs);
+	stats_add(&global.ioNanos, r->stats.ioNanos);
+	stats_add(&global.swapNanos, r->stats.swapNanos);
+	stats_add(&global.convertNanos, r->stats.convertNanos);
+}
+
+#endif /* AIFF_STATS */
+
+/*
+ * Get the counters of 'r' or, if 'r' is NULL, the sum of those
+ * of all the references closed so far. Return 1, 0 if the library
+ * was built without --enable-stats (the counters are then zero),
+ * or -1 on error.
+ */
+int
+AIFF_GetStats(AIFF_Ref r, AIFF_IOStats * st)
+{
+	if (!st)
+		return (-1);
+	memset(st, 0, sizeof(AIFF_IOStats));
+#ifdef AIFF_STATS
+	if (r) {
+		*st = r->stats;
+		return (1);
+	}
+	st->bytesRead = ATOMIC_LOAD(&global.bytesRead);
+	st->bytesWritten = ATOMIC_LOAD(&global.bytesWritten);
+	st->readCalls = ATOMIC_LOAD(&global.readCalls);
+	st->writeCalls = ATOMIC_LOAD(&global.writeCalls);
+	st->seeks = ATOMIC_LOAD(&global.seeks);
+	st->chunkScans = ATOMIC_LOAD(&global.chunkScans);
+	st->bufAllocs = ATOMIC_LOAD(&global.bufAllocs);
+	st->ioNanos = ATOMIC_LOAD(&global.ioNanos);
+	st->swapNanos = ATOMIC_LOAD(&global.swapNanos);
+	st->convertNanos = ATOMIC_LOAD(&global.convertNanos);
+	return (1);
+#else
+	(void) r;
+	return (0);
+#endif
+}
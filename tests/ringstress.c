@@ -0,0 +1,216 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Frame ring stress test.
+ *
+ * A producer thread decodes a test file into a ring with AIFF_RingFill
+ * while the main thread drains it like an audio callback would: a
+ * fixed number of frames at a fixed period, never waiting. The period
+ * is shorter than real time so the producer is kept busy. Each frame
+ * read is checked against what was written. The program reports the
+ * longest AIFF_RingRead call and the number of callbacks which found
+ * the ring short (underruns), and fails if a frame is wrong or the
+ * producer fails. Underruns depend on the machine and do not fail it.
+ */
+
+#ifdef AIFF_THREADS
+
+#include <pthread.h>
+#include <time.h>
+
+#define kStressFile	"ringstress.aiff"
+#define kStressChannels	2
+#define kStressFrames	(1 << 19)
+#define kStressRing	8192	/* frames in the ring */
+#define kStressBlock	1024	/* frames decoded at a time */
+#define kStressPeriod	256	/* frames read per callback */
+#define kStressInterval	1000000	/* nanoseconds between callbacks */
+
+struct s_Producer {
+	AIFF_Ref        r;
+	AIFF_RingRef    q;
+	int             res;
+};
+
+static int
+sample_at(uint64_t i)
+{
+	return ((int) (i & 0xFFFF) - 32768);
+}
+
+static void
+sleep_ns(long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	nanosleep(&ts, NULL);
+}
+
+static int
+make_file(const char *path)
+{
+	AIFF_Ref        w;
+	int32_t        *buf;
+	uint64_t        frame, i;
+	int             ok;
+
+	if ((w = AIFF_OpenFile(path, F_WRONLY)) == NULL)
+		return (-1);
+	if ((buf = malloc(kStressBlock * kStressChannels * sizeof(int32_t))) == NULL) {
+		AIFF_CloseFile(w);
+		return (-1);
+	}
+	ok = AIFF_SetAudioFormat(w, kStressChannels, 44100.0, 16) > 0 &&
+	    AIFF_StartWritingSamples(w) > 0;
+	for (frame = 0; ok && frame < kStressFrames; frame += kStressBlock) {
+		for (i = 0; i < kStressBlock * kStressChannels; i++)
+			buf[i] = (int32_t) ((uint32_t) sample_at(frame * kStressChannels + i) << 16);
+		ok = AIFF_WriteSamples32Bit(w, buf, kStressBlock * kStressChannels) > 0;
+	}
+	free(buf);
+	ok = ok && AIFF_EndWritingSamples(w) > 0;
+	if (AIFF_CloseFile(w) < 1)
+		ok = 0;
+
+	return (ok ? 1 : -1);
+}
+
+static void    *
+producer(void *arg)
+{
+	struct s_Producer *p = arg;
+	int             n;
+
+	for (;;) {
+		if (AIFF_RingWritable(p->q) < kStressBlock) {
+			sleep_ns(50000);
+			continue;
+		}
+		if ((n = AIFF_RingFill(p->r, p->q, kStressBlock)) < 1) {
+			p->res = n;
+			break;
+		}
+	}
+
+	return (NULL);
+}
+
+int
+main(void)
+{
+	struct s_Producer p;
+	pthread_t       thread;
+	float          *buf;
+	uint64_t        frame = 0, calls = 0, underruns = 0, bad = 0;
+	uint64_t        t0, t, lat, maxLat = 0, next;
+	unsigned int    n, i;
+	int             end;
+
+	if (make_file(kStressFile) < 1) {
+		fprintf(stderr, "ringstress: cannot write %s\n", kStressFile);
+		return (1);
+	}
+	if ((p.r = AIFF_OpenFile(kStressFile, F_RDONLY)) == NULL ||
+	    (p.q = AIFF_RingCreate(p.r, kStressRing, kRingFloat)) == NULL ||
+	    (buf = malloc(kStressPeriod * kStressChannels * sizeof(float))) == NULL) {
+		fprintf(stderr, "ringstress: cannot open %s\n", kStressFile);
+		return (1);
+	}
+	p.res = 0;
+	if (pthread_create(&thread, NULL, producer, &p) != 0) {
+		fprintf(stderr, "ringstress: cannot start the producer\n");
+		return (1);
+	}
+
+	/* pre-roll half of the ring, as a player would */
+	while (AIFF_RingReadable(p.q) < kStressRing / 2 && !AIFF_RingEnded(p.q))
+		sleep_ns(100000);
+
+	next = stats_clock();
+	while ((end = AIFF_RingEnded(p.q)) == 0) {
+		t0 = stats_clock();
+		n = AIFF_RingRead(p.q, buf, kStressPeriod);
+		lat = stats_clock() - t0;
+		maxLat = MAX(maxLat, lat);
+		calls++;
+		if (n < kStressPeriod && frame + n < kStressFrames)
+			underruns++;
+		for (i = 0; i < n * kStressChannels; i++) {
+			if ((int) (buf[i] * 32768.0f) !=
+			    sample_at(frame * kStressChannels + i))
+				bad++;
+		}
+		frame += n;
+
+		next += kStressInterval;
+		if ((t = stats_clock()) < next)
+			sleep_ns((long) (next - t));
+	}
+	pthread_join(thread, NULL);
+
+	printf("ringstress: %lu frames in %lu callbacks, max read latency %lu ns, "
+	    "%lu underruns\n", (unsigned long) frame, (unsigned long) calls,
+	    (unsigned long) maxLat, (unsigned long) underruns);
+
+	free(buf);
+	AIFF_RingDelete(p.q);
+	AIFF_CloseFile(p.r);
+	remove(kStressFile);
+
+	if (p.res < 0 || end < 0 || frame != kStressFrames || bad) {
+		fprintf(stderr, "ringstress: FAILED (%lu bad samples, %lu frames)\n",
+		    (unsigned long) bad, (unsigned long) frame);
+		return (1);
+	}
+
+	return (0);
+}
+
+#else /* !AIFF_THREADS */
+
+int
+main(void)
+{
+	printf("ringstress: built without threads, skipped\n");
+	return (0);
+}
+
+#endif /* AIFF_THREADS */
@@ -0,0 +1,275 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Tracing.
+ *
+ * The hot paths (opening, preparing the sound, finding a chunk, the
+ * codec calls and closing) call the hooks of private.h on entry and
+ * exit. While a callback is set, each hook passes it the operation,
+ * the phase, a monotonic timestamp in nanoseconds (see stats_clock)
+ * and, on exit, the bytes of the file the operation moved.
+ *
+ * The Chrome trace writer is one such callback: it writes a duration
+ * event per hook in the JSON array format read by chrome://tracing
+ * and Perfetto. Every thread gets a small number of its own, so the
+ * events of the read-ahead and spool workers nest apart from those
+ * of the caller.
+ */
+
+#ifdef AIFF_THREADS
+#include <pthread.h>
+#endif
+
+/*
+ * The callback and its data are published together: a hook loads
+ * 'trace_hook' once and never pairs a function with the data of
+ * another. A slot of 'trace_hooks' is only filled again kTraceHooks
+ * changes later, long after any hook that loaded it has returned.
+ */
+struct s_TraceHook {
+	AIFF_TraceFunc  func;
+	void           *data;
+};
+
+#define kTraceHooks	8
+
+struct s_TraceHook *trace_hook = NULL;
+static struct s_TraceHook trace_hooks[kTraceHooks];
+static unsigned int trace_next = 0;
+
+static const char *trace_names[] = {
+	"open",
+	"prepare",
+	"find_chunk",
+	"read_lpcm",
+	"read_float32",
+	"write_lpcm",
+	"seek",
+	"close"
+};
+
+#define kTraceNames	(int) (sizeof(trace_names) / sizeof(trace_names[0]))
+
+/*
+ * Set the callback, or stop tracing if 'f' is NULL. A hook
+ * running meanwhile in another thread may still make one last
+ * call to the previous callback, with its own data.
+ */
+void
+AIFF_SetTraceCallback(AIFF_TraceFunc f, void *userData)
+{
+	struct s_TraceHook *h = NULL;
+	unsigned int    i;
+
+	if (f) {
+#ifdef ATOMIC_FETCH_ADD
+		i = ATOMIC_FETCH_ADD(&trace_next, 1);
+#else
+		i = trace_next++;
+#endif
+		h = &trace_hooks[i % kTraceHooks];
+		h->func = f;
+		h->data = userData;
+	}
+	ATOMIC_STORE(&trace_hook, h);
+}
+
+const char     *
+AIFF_TraceName(int op)
+{
+	if (op < 0 || op >= kTraceNames)
+		return (NULL);
+	return (trace_names[op]);
+}
+
+void
+trace_event(AIFF_Ref r, int op, int phase, uint64_t bytes)
+{
+	struct s_TraceHook *h = ATOMIC_LOAD(&trace_hook);
+
+	if (h)
+		h->func(h->data, r, op, phase, stats_clock(), bytes);
+}
+
+/*
+ * The Chrome trace writer.
+ */
+
+struct s_TraceFile {
+	FILE           *f;
+	uint64_t        origin;	/* timestamp of the start of the trace */
+	unsigned long   nEvents;
+};
+
+static struct s_TraceFile *trace_file = NULL;
+
+#ifdef AIFF_THREADS
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static int      trace_keyed = 0;
+static unsigned long trace_tids = 0;
+
+static void
+trace_make_key(void)
+{
+	trace_keyed = (pthread_key_create(&trace_key, NULL) == 0);
+}
+
+/* Called with the lock held. */
+static unsigned long
+trace_tid(void)
+{
+	unsigned long   tid;
+	void           *v;
+
+	pthread_once(&trace_once, trace_make_key);
+	if (!trace_keyed)
+		return (1);
+	v = pthread_getspecific(trace_key);
+	if ((tid = (unsigned long) (size_t) v) == 0) {
+		tid = ++trace_tids;
+		pthread_setspecific(trace_key, (void *) (size_t) tid);
+	}
+	return (tid);
+}
+
+#define TRACE_LOCK()	pthread_mutex_lock(&trace_lock)
+#define TRACE_UNLOCK()	pthread_mutex_unlock(&trace_lock)
+#else
+#define trace_tid()	1UL
+#define TRACE_LOCK()
+#define TRACE_UNLOCK()
+#endif
+
+/*
+ * Print 'v' in decimal: ISO C90 printf has no 64-bit conversion.
+ */
+static char    *
+u64dec(uint64_t v, char *end)
+{
+	*--end = '\0';
+	do {
+		*--end = (char) ('0' + (int) (v % 10));
+		v /= 10;
+	} while (v > 0);
+	return (end);
+}
+
+static void
+trace_write(void *arg, AIFF_Ref r, int op, int phase, uint64_t nanos,
+    uint64_t bytes)
+{
+	struct s_TraceFile *t = arg;
+	char            us[24], nb[24];
+
+	(void) r;
+	if (op < 0 || op >= kTraceNames)
+		return;
+	TRACE_LOCK();
+	if (t != NULL && t == trace_file) {	/* not ended meanwhile */
+		nanos = (nanos > t->origin ? nanos - t->origin : 0);
+		fprintf(t->f, "%s{\"name\":\"%s\",\"cat\":\"libaiff\",\"ph\":\"%s\","
+		    "\"ts\":%s.%03u,\"pid\":1,\"tid\":%lu",
+		    (t->nEvents++ > 0 ? ",\n" : ""), trace_names[op],
+		    (phase == kTraceBegin ? "B" : "E"),
+		    u64dec(nanos / 1000, us + sizeof(us)),
+		    (unsigned int) (nanos % 1000), trace_tid());
+		if (phase == kTraceEnd)
+			fprintf(t->f, ",\"args\":{\"bytes\":%s}",
+			    u64dec(bytes, nb + sizeof(nb)));
+		fputs("}", t->f);
+	}
+	TRACE_UNLOCK();
+}
+
+/*
+ * Start writing the trace to the file 'path', replacing the
+ * callback. Return 1, or -1 on error.
+ */
+int
+AIFF_StartTraceFile(const char *path)
+{
+	struct s_TraceFile *t;
+
+	if (!path || trace_file)
+		return (-1);
+	if ((t = malloc(sizeof(struct s_TraceFile))) == NULL)
+		return (-1);
+	if ((t->f = fopen(path, "w")) == NULL) {
+		free(t);
+		return (-1);
+	}
+	fputs("[\n", t->f);
+	t->origin = stats_clock();
+	t->nEvents = 0;
+
+	TRACE_LOCK();
+	trace_file = t;
+	TRACE_UNLOCK();
+	AIFF_SetTraceCallback(trace_write, t);
+
+	return (1);
+}
+
+/*
+ * Stop tracing and close the trace file. Return 1, 0 if no trace
+ * file was being written, or -1 if it could not be written.
+ */
+int
+AIFF_EndTraceFile(void)
+{
+	struct s_TraceFile *t;
+	int             res = 1;
+
+	TRACE_LOCK();
+	if ((t = trace_file) != NULL)
+		trace_file = NULL;
+	TRACE_UNLOCK();
+	if (t == NULL)
+		return (0);
+	AIFF_SetTraceCallback(NULL, NULL);
+
+	fputs("\n]\n", t->f);
+	if (ferror(t->f))
+		res = -1;
+	if (fclose(t->f) != 0)
+		res = -1;
+	free(t);
+
+	return (res);
+}
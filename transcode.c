@@ -0,0 +1,243 @@
+/*	$Id$ */
+
+/*-
+ * Copyright (c) 2005, 2006, 2007, 2008 Marco Trillo
+ *
+ * Permission is hereby granted, free of charge, to any
+ * person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice
+ * shall be included in all copies or substantial portions of
+ * the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+ * KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#define _XOPEN_SOURCE 600
+#define LIBAIFF 1
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <libaiff/libaiff.h>
+#include "private.h"
+
+/*
+ * Batch transcoding.
+ *
+ * Every job converts one file, keeping its attributes and markers.
+ * The jobs are spread among a pool of threads: each thread takes
+ * the next job not yet taken, so a thread stuck with a long file
+ * does not hold the others back. Each thread uses one buffer of
+ * at most 'bufFrames' sample frames.
+ */
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef AIFF_THREADS
+#include <pthread.h>
+#endif
+
+#define kTranscodeDefFrames	16384
+#define kTranscodeMaxThreads	64
+
+struct s_Transcoder {
+	AIFF_Job       *jobs;
+	int             nJobs;
+	int             next;
+	int             bufFrames;
+};
+
+static double
+transcode_clock(void)
+{
+	struct timeval  tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec * 1e-6);
+}
+
+static int
+transcode_markers(AIFF_Ref w, AIFF_Ref r)
+{
+	AIFF_MarkerList *markers;
+	int             res;
+
+	if ((res = AIFF_ReadAllMarkers(r, &markers)) < 1)
+		return (res < 0 ? -1 : 1);	/* no markers */
+	res = AIFF_WriteMarkers(w, markers->markers, markers->nMarkers);
+	AIFF_FreeMarkers(markers);
+
+	return (res);
+}
+
+/*
+ * Convert one file. '*buf' and '*bufLen' are the thread's buffer,
+ * grown as needed.
+ */
+static int
+transcode_one(AIFF_Job * job, int bufFrames, int32_t ** buf, size_t * bufLen)
+{
+	AIFF_Ref        r, w;
+	uint64_t        nFrames;
+	int             channels, bits, segSize, n, nSamples, res = -1;
+	double          rate;
+	size_t          len;
+
+	if ((r = AIFF_OpenFile(job->input, F_RDONLY)) == NULL)
+		return (-1);
+	if (AIFF_GetAudioFormat(r, &nFrames, &channels, &rate, &bits, &segSize) < 1)
+		goto out0;
+	if ((w = AIFF_OpenFile(job->output, F_WRONLY | job->flags)) == NULL)
+		goto out0;
+
+	if (job->bitsPerSample > 0)
+		bits = job->bitsPerSample;
+	if (job->encoding == AUDIO_FORMAT_ULAW || job->encoding == AUDIO_FORMAT_ALAW)
+		bits = 16;
+	if (AIFF_CloneAttributes(w, r, 0) < 0)
+		goto out1;
+	if (job->encoding && AIFF_SetAudioEncoding(w, job->encoding) < 1)
+		goto out1;
+	if (AIFF_SetAudioFormat(w, channels, rate, bits) < 1)
+		goto out1;
+	if (AIFF_StartWritingSamples(w) < 1)
+		goto out1;
+
+	len = (size_t) bufFrames * channels * sizeof(int32_t);
+	if (*bufLen < len) {
+		free(*buf);
+		if ((*buf = malloc(len)) == NULL) {
+			*bufLen = 0;
+			goto out1;
+		}
+		*bufLen = len;
+	}
+
+	nSamples = bufFrames * channels;
+	job->nFrames = 0;
+	while ((n = AIFF_ReadSamples32Bit(r, *buf, nSamples)) > 0) {
+		if (AIFF_WriteSamples32Bit(w, *buf, n) < 0)
+			goto out1;
+		job->nFrames += n / channels;
+	}
+	if (n < 0 || AIFF_EndWritingSamples(w) < 1)
+		goto out1;
+	if (transcode_markers(w, r) < 1)
+		goto out1;
+	res = 1;
+
+out1:
+	if (AIFF_CloseFile(w) < 0)
+		res = -1;
+	if (res < 1)
+		remove(job->output);
+out0:
+	AIFF_CloseFile(r);
+	return (res);
+}
+
+static int
+transcode_take(struct s_Transcoder *t)
+{
+#ifdef ATOMIC_FETCH_ADD
+	return (ATOMIC_FETCH_ADD(&t->next, 1));
+#else
+	return (t->next++);
+#endif
+}
+
+static void    *
+transcode_worker(void *arg)
+{
+	struct s_Transcoder *t = arg;
+	AIFF_Job       *job;
+	int32_t        *buf = NULL;
+	size_t          bufLen = 0;
+	double          t0;
+	int             i;
+
+	while ((i = transcode_take(t)) < t->nJobs) {
+		job = &t->jobs[i];
+		t0 = transcode_clock();
+		job->result = transcode_one(job, t->bufFrames, &buf, &bufLen);
+		job->seconds = transcode_clock() - t0;
+		if (job->result > 0 && job->seconds > 0)
+			job->framesPerSecond = job->nFrames / job->seconds;
+	}
+	free(buf);
+
+	return (NULL);
+}
+
+/*
+ * Run 'nJobs' jobs on 'nThreads' threads (0 for one per processor)
+ * with buffers of 'bufFrames' sample frames (0 for the default).
+ * Return the number of jobs that succeeded, or -1 on error.
+ */
+int
+AIFF_Transcode(AIFF_Job * jobs, int nJobs, int nThreads, int bufFrames)
+{
+	struct s_Transcoder t;
+	int             i, ok;
+#ifdef AIFF_THREADS
+	pthread_t       threads[kTranscodeMaxThreads];
+	int             started;
+#endif
+
+	if (!jobs || nJobs < 0)
+		return (-1);
+	for (i = 0; i < nJobs; i++) {
+		jobs[i].result = 0;
+		jobs[i].nFrames = 0;
+		jobs[i].seconds = 0;
+		jobs[i].framesPerSecond = 0;
+	}
+	t.jobs = jobs;
+	t.nJobs = nJobs;
+	t.next = 0;
+	t.bufFrames = (bufFrames > 0 ? bufFrames : kTranscodeDefFrames);
+
+	if (nThreads < 1) {
+#ifdef _SC_NPROCESSORS_ONLN
+		nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (nThreads < 1)
+			nThreads = 1;
+	}
+	nThreads = MIN(nThreads, MIN(nJobs, kTranscodeMaxThreads));
+
+#ifdef AIFF_THREADS
+	for (started = 1; started < nThreads; started++) {
+		if (pthread_create(&threads[started], NULL, transcode_worker, &t) != 0)
+			break;
+	}
+	transcode_worker(&t);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+#else
+	transcode_worker(&t);
+#endif
+
+	for (i = 0, ok = 0; i < nJobs; i++) {
+		if (jobs[i].result > 0)
+			ok++;
+	}
+
+	return (ok);
+}